@@ -0,0 +1,22 @@
+#ifndef _ISPC_ITASKSYS_H
+#define _ISPC_ITASKSYS_H
+
+class ITaskSystem;
+
+/*
+ * With tasksys.cpp built with -DISPC_USE_ITASKSYS, ispc launch[] runs on a
+ * CS149 LAB2 task system owned by the program instead of on threads of its
+ * own, so ispc kernels and C++ runnables share one pool:
+ *
+ *   TaskSystemParallelThreadPoolSleeping t(8);
+ *   ISPCSetTaskSystem(&t);
+ *   mandelbrot_ispc_withtasks(...);     // each launch[n] is t.run(.., n)
+ *
+ * The task system must be set before the first launch[] and outlive the
+ * last sync. A task that itself launches needs a task system whose run()
+ * may be called from inside a task (part_b's sleeping pool).
+ */
+void ISPCSetTaskSystem(ITaskSystem *taskSystem);
+ITaskSystem *ISPCGetTaskSystem();
+
+#endif
@@ -17,6 +17,8 @@
     - Microsoft's Concurrency Runtime (ISPC_USE_CONCRT)
     - Apple's Grand Central Dispatch (ISPC_USE_GCD)
     - bare pthreads (ISPC_USE_PTHREADS, ISPC_USE_PTHREADS_FULLY_SUBSCRIBED)
+    - work stealing over pthreads and futexes, Linux only (ISPC_USE_WORKSTEALING)
+    - a CS149 LAB2 ITaskSystem supplied by the program (ISPC_USE_ITASKSYS)
     - TBB (ISPC_USE_TBB_TASK_GROUP, ISPC_USE_TBB_PARALLEL_FOR)
     - OpenMP (ISPC_USE_OMP)
     - HPX (ISPC_USE_HPX)
@@ -40,6 +42,25 @@
   for task management.  This model is useful for KNC where tasks can take over
   the machine, but less so when there are other tasks that need running on the machine.
 
+#define ISPC_USE_WORKSTEALING
+  The ISPC_USE_WORKSTEALING model keeps one pthread per core but one
+  lock-free (Chase-Lev) deque per thread. A launch pushes a single range of
+  task indices; whoever runs it splits it in halves, pushing the upper half
+  where idle threads can steal it, so a launch costs one push no matter how
+  many tasks it has and there is no cap on live launches. Idle workers and
+  waiting syncs sleep on futexes rather than polling. Threads outside the
+  pool that launch and sync run tasks too, each with a threadIndex of its
+  own past the workers'.
+
+#define ISPC_USE_ITASKSYS
+  The ISPC_USE_ITASKSYS model has no threads of its own: each launch[] is
+  one bulk launch, through run(), on the ITaskSystem the program passed to
+  ISPCSetTaskSystem() (see ispc_itasksys.h), so ispc kernels and C++
+  runnables share one pool instead of oversubscribing the machine. Build
+  with the LAB2 part_a or part_b directory on the include path and link
+  that task system. Since run() returns when the tasks are done, sync is
+  free, as with ISPC_USE_OMP.
+
 #define ISPC_USE_CREW
 #define ISPC_USE_HPX
   The HPX model requires the HPX runtime environment to be set up. This can be
@@ -52,7 +73,8 @@
 
 #if !(defined ISPC_USE_CONCRT || defined ISPC_USE_GCD || defined ISPC_USE_PTHREADS ||                                  \
       defined ISPC_USE_PTHREADS_FULLY_SUBSCRIBED || defined ISPC_USE_TBB_TASK_GROUP ||                                 \
-      defined ISPC_USE_TBB_PARALLEL_FOR || defined ISPC_USE_OMP || defined ISPC_USE_HPX)
+      defined ISPC_USE_TBB_PARALLEL_FOR || defined ISPC_USE_OMP || defined ISPC_USE_HPX ||                              \
+      defined ISPC_USE_WORKSTEALING || defined ISPC_USE_ITASKSYS)
 
 // If no task model chosen from the compiler cmdline, pick a reasonable default
 #if defined(_WIN32) || defined(_WIN64)
@@ -113,6 +135,18 @@ using namespace Concurrency;
 //#include <stdexcept>
 #include <stack>
 #endif // ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
+#ifdef ISPC_USE_WORKSTEALING
+#include <atomic>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // ISPC_USE_WORKSTEALING
+#ifdef ISPC_USE_ITASKSYS
+#include "ispc_itasksys.h"
+#include "itasksys.h"
+#endif // ISPC_USE_ITASKSYS
 #ifdef ISPC_USE_TBB_PARALLEL_FOR
 #include <tbb/parallel_for.h>
 #endif // ISPC_USE_TBB_PARALLEL_FOR
@@ -176,7 +210,82 @@ void ISPCSync(void *handle);
 
 #define MAX_LAUNCHED_TASKS (MAX_TASK_QUEUE_CHUNKS * TASK_QUEUE_CHUNK_SIZE)
 
-#define NUM_MEM_BUFFERS 16
+#define ARENA_INITIAL_BLOCK_SIZE (16 * 1024)
+#define MAX_ARENA_BLOCKS 32
+
+/** Arena is the per-thread bump allocator behind ISPCAlloc().  ispc
+    allocates task arguments in the function that launches the tasks, and
+    that function syncs before it returns, so a thread's allocations are
+    released in stack order: a task group remembers the arena position at
+    its first allocation and rolls the arena back to it when it is synced.
+    Blocks are never freed while the thread lives, so once the arena has
+    grown to a program's working set, launch[] does no malloc or free.
+ */
+class Arena {
+  public:
+    struct Mark {
+        int block;
+        int64_t offset;
+    };
+
+    Arena() : curBlock(0), curOffset(0), numBlocks(0) {}
+    ~Arena() {
+        for (int i = 0; i < numBlocks; ++i)
+            delete[] blocks[i];
+    }
+
+    Mark GetMark() const {
+        Mark mark = {curBlock, curOffset};
+        return mark;
+    }
+    void Release(const Mark &mark) {
+        curBlock = mark.block;
+        curOffset = mark.offset;
+    }
+
+    void *Alloc(int64_t size, int32_t alignment);
+
+  private:
+    int curBlock;
+    int64_t curOffset;
+    int numBlocks;
+    int64_t blockSize[MAX_ARENA_BLOCKS];
+    char *blocks[MAX_ARENA_BLOCKS];
+};
+
+inline void *Arena::Alloc(int64_t size, int32_t alignment) {
+    while (1) {
+        // Blocks past curBlock are free; one too small for this request
+        // is skipped until the arena is released below it.
+        for (; curBlock < numBlocks; ++curBlock, curOffset = 0) {
+            intptr_t base = (intptr_t)blocks[curBlock];
+            intptr_t iptr = (base + curOffset + (alignment - 1)) & ~(intptr_t)(alignment - 1);
+            if (iptr + size <= base + blockSize[curBlock]) {
+                curOffset = iptr + size - base;
+                return (char *)iptr;
+            }
+            if (curBlock + 1 == numBlocks)
+                break;
+        }
+
+        if (numBlocks == MAX_ARENA_BLOCKS) {
+            fprintf(stderr,
+                    "ISPCAlloc() arena is out of blocks.  Increase MAX_ARENA_BLOCKS "
+                    "and recompile.  Exiting.\n");
+            exit(1);
+        }
+        int64_t newSize = std::max(size + alignment, (int64_t)ARENA_INITIAL_BLOCK_SIZE << numBlocks);
+        blocks[numBlocks] = new char[newSize];
+        blockSize[numBlocks] = newSize;
+        curBlock = numBlocks++;
+        curOffset = 0;
+    }
+}
+
+static inline Arena *lThreadArena() {
+    static thread_local Arena arena;
+    return &arena;
+}
 
 class TaskGroup;
 
@@ -208,44 +317,31 @@ class TaskGroupBase {
      */
     TaskInfo *taskInfo[MAX_TASK_QUEUE_CHUNKS];
 
-    /* We also allocate chunks of memory to service ISPCAlloc() calls.  The
-       memBuffers[] array holds pointers to this memory.  The first element
-       of this array is initialized to point to mem and then any subsequent
-       elements required are initialized with dynamic allocation.
+    /* ISPCAlloc() calls are served from the arena of the thread running
+       the launching function, which Reset() rolls back to arenaMark; arena
+       is nullptr until the first allocation.
      */
-    int curMemBuffer, curMemBufferOffset;
-    int memBufferSize[NUM_MEM_BUFFERS];
-    char *memBuffers[NUM_MEM_BUFFERS];
-    char mem[256];
+    Arena *arena;
+    Arena::Mark arenaMark;
 };
 
 inline TaskGroupBase::TaskGroupBase() {
     nextTaskInfoIndex = 0;
 
-    curMemBuffer = 0;
-    curMemBufferOffset = 0;
-    memBuffers[0] = mem;
-    memBufferSize[0] = sizeof(mem) / sizeof(mem[0]);
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i) {
-        memBuffers[i] = nullptr;
-        memBufferSize[i] = 0;
-    }
+    arena = nullptr;
 
     for (int i = 0; i < MAX_TASK_QUEUE_CHUNKS; ++i)
         taskInfo[i] = nullptr;
 }
 
-inline TaskGroupBase::~TaskGroupBase() {
-    // Note: don't delete memBuffers[0], since it points to the start of
-    // the "mem" member!
-    for (int i = 1; i < NUM_MEM_BUFFERS; ++i)
-        delete[](memBuffers[i]);
-}
+inline TaskGroupBase::~TaskGroupBase() { assert(arena == nullptr); }
 
 inline void TaskGroupBase::Reset() {
     nextTaskInfoIndex = 0;
-    curMemBuffer = 0;
-    curMemBufferOffset = 0;
+    if (arena != nullptr) {
+        arena->Release(arenaMark);
+        arena = nullptr;
+    }
 }
 
 inline int TaskGroupBase::AllocTaskInfo(int count) {
@@ -275,26 +371,11 @@ inline TaskInfo *TaskGroupBase::GetTaskInfo(int index) {
 }
 
 inline void *TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
-    char *basePtr = memBuffers[curMemBuffer];
-    intptr_t iptr = (intptr_t)(basePtr + curMemBufferOffset);
-    iptr = (iptr + (alignment - 1)) & ~(alignment - 1);
-
-    int newOffset = int(iptr - (intptr_t)basePtr + size);
-    if (newOffset < memBufferSize[curMemBuffer]) {
-        curMemBufferOffset = newOffset;
-        return (char *)iptr;
+    if (arena == nullptr) {
+        arena = lThreadArena();
+        arenaMark = arena->GetMark();
     }
-
-    ++curMemBuffer;
-    curMemBufferOffset = 0;
-    assert(curMemBuffer < NUM_MEM_BUFFERS);
-
-    int allocSize = 1 << (12 + curMemBuffer);
-    allocSize = std::max(int(size + alignment), allocSize);
-    char *newBuf = new char[allocSize];
-    memBufferSize[curMemBuffer] = allocSize;
-    memBuffers[curMemBuffer] = newBuf;
-    return AllocMemory(size, alignment);
+    return arena->Alloc(size, alignment);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -443,6 +524,43 @@ class TaskGroup : public TaskGroupBase {
 
 #endif // ISPC_USE_HPX
 
+#ifdef ISPC_USE_WORKSTEALING
+struct WsRange;
+static void lWsRunRange(WsRange *range);
+
+class TaskGroup : public TaskGroupBase {
+  public:
+    TaskGroup() : numUnfinishedTasks(0) {}
+
+    void Reset() {
+        TaskGroupBase::Reset();
+        numUnfinishedTasks.store(0, std::memory_order_relaxed);
+    }
+
+    void Launch(int baseIndex, int count);
+    void Sync();
+
+  private:
+    friend void lWsRunRange(WsRange *range);
+
+    /* Twice the number of unfinished tasks, plus 1 while Sync() sleeps on
+       it as a futex, so the thread finishing the last task knows whether
+       a wake-up is needed without touching the group again. */
+    std::atomic<int32_t> numUnfinishedTasks;
+};
+
+#endif // ISPC_USE_WORKSTEALING
+
+#ifdef ISPC_USE_ITASKSYS
+
+class TaskGroup : public TaskGroupBase {
+  public:
+    void Launch(int baseIndex, int count);
+    void Sync();
+};
+
+#endif // ISPC_USE_ITASKSYS
+
 ///////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////
@@ -938,6 +1056,415 @@ inline void TaskGroup::Sync() {
     futures.clear();
 }
 #endif
+
+///////////////////////////////////////////////////////////////////////////
+// Work stealing
+
+#ifdef ISPC_USE_WORKSTEALING
+
+// Idle rounds over all deques before a thread goes to sleep
+#define WS_SPIN_ROUNDS 64
+// Ranges each launch is split into per thread, at most
+#define WS_RANGES_PER_THREAD 4
+#define WS_INITIAL_DEQUE_SIZE 64
+#define WS_MAX_FREE_RANGES 1024
+
+static long lFutexWait(std::atomic<int32_t> *addr, int32_t expected) {
+    return syscall(SYS_futex, (int32_t *)addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static long lFutexWake(std::atomic<int32_t> *addr, int32_t count) {
+    return syscall(SYS_futex, (int32_t *)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/* Tasks [begin, end) of one launch. The launch's TaskInfo holds the
+   function, data and task counts; its taskIndex is unused. */
+struct WsRange {
+    TaskInfo *launch;
+    TaskGroup *group;
+    int begin, end;
+    int grain; // stop splitting at this many tasks
+    WsRange *nextFree;
+};
+
+/* Chase-Lev work-stealing deque (with the C11 memory orderings of Le et
+   al., "Correct and Efficient Work-Stealing for Weak Memory Models"). The
+   owning thread pushes and takes at the bottom; any thread steals from
+   the top. It grows as needed; outgrown arrays are kept since a thief may
+   still be reading one. */
+class WsDeque {
+  public:
+    std::atomic<bool> owned; // claimed by a live thread
+    WsDeque *next;           // in the list of all deques
+    int index;               // threadIndex of the thread that owns it
+
+    WsDeque() : owned(false), next(nullptr), index(-1), top(0), bottom(0), freeRanges(nullptr), numFreeRanges(0) {
+        array.store(new Array(WS_INITIAL_DEQUE_SIZE, nullptr), std::memory_order_relaxed);
+    }
+
+    void Push(WsRange *range) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array *a = array.load(std::memory_order_relaxed);
+        if (b - t > a->size - 1) {
+            a = a->Grow(t, b);
+            array.store(a, std::memory_order_release);
+        }
+        a->Put(b, range);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    WsRange *Take() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        WsRange *range = a->Get(b);
+        if (t == b) {
+            // Last one: race thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                range = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return range;
+    }
+
+    WsRange *Steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Array *a = array.load(std::memory_order_acquire);
+        WsRange *range = a->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return range;
+    }
+
+    /* WsRanges are recycled through a free list per deque, used only by the
+       owner: a range goes back to the list of whichever thread ran it. */
+    WsRange *AllocRange() {
+        WsRange *range = freeRanges;
+        if (range == nullptr)
+            return new WsRange;
+        freeRanges = range->nextFree;
+        --numFreeRanges;
+        return range;
+    }
+
+    void FreeRange(WsRange *range) {
+        if (numFreeRanges == WS_MAX_FREE_RANGES) {
+            delete range;
+            return;
+        }
+        range->nextFree = freeRanges;
+        freeRanges = range;
+        ++numFreeRanges;
+    }
+
+  private:
+    struct Array {
+        int64_t size; // power of two
+        std::atomic<WsRange *> *slots;
+        Array *previous;
+
+        Array(int64_t n, Array *prev) : size(n), slots(new std::atomic<WsRange *>[n]), previous(prev) {}
+        WsRange *Get(int64_t i) { return slots[i & (size - 1)].load(std::memory_order_relaxed); }
+        void Put(int64_t i, WsRange *range) { slots[i & (size - 1)].store(range, std::memory_order_relaxed); }
+        Array *Grow(int64_t t, int64_t b) {
+            Array *a = new Array(2 * size, this);
+            for (int64_t i = t; i < b; ++i)
+                a->Put(i, Get(i));
+            return a;
+        }
+    };
+
+    std::atomic<int64_t> top, bottom;
+    std::atomic<Array *> array;
+    WsRange *freeRanges;
+    int numFreeRanges;
+};
+
+static volatile int32_t lock = 0;
+
+static int nThreads = -1; // worker threads; threads that only launch and sync also run tasks
+static pthread_t *threads = nullptr;
+
+static std::atomic<WsDeque *> wsDeques(nullptr);
+static std::atomic<int32_t> wsNumDeques(0);
+
+/* Idle workers sleep on wsEpoch; a push bumps it and wakes one of them if
+   wsNumSleepers says anyone might be asleep. */
+static std::atomic<int32_t> wsEpoch(0);
+static std::atomic<int32_t> wsNumSleepers(0);
+
+struct WsThread {
+    WsDeque *deque;
+
+    WsThread() : deque(nullptr) {}
+    // Hand the (empty) deque to the next thread that needs one
+    ~WsThread() {
+        if (deque != nullptr)
+            deque->owned.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local WsThread wsThread;
+
+static WsDeque *lWsMyDeque() {
+    if (wsThread.deque != nullptr)
+        return wsThread.deque;
+
+    // Reuse the deque of a thread that has exited, else add one
+    for (WsDeque *d = wsDeques.load(std::memory_order_acquire); d != nullptr; d = d->next) {
+        bool expected = false;
+        if (!d->owned.load(std::memory_order_relaxed) && d->owned.compare_exchange_strong(expected, true)) {
+            wsThread.deque = d;
+            return d;
+        }
+    }
+    WsDeque *d = new WsDeque;
+    d->owned.store(true, std::memory_order_relaxed);
+    d->index = wsNumDeques.fetch_add(1, std::memory_order_relaxed);
+    d->next = wsDeques.load(std::memory_order_relaxed);
+    while (!wsDeques.compare_exchange_weak(d->next, d, std::memory_order_release, std::memory_order_relaxed))
+        ;
+    wsThread.deque = d;
+    return d;
+}
+
+/* Every thread that runs tasks, worker or not, owns a deque, and no two
+   live threads own the same one, so deque->index serves as a threadIndex
+   unique among the threads running tasks at any moment. threadCount is
+   the number of deques so far, which only grows as new threads launch. */
+static inline int lWsThreadCount(const WsDeque *deque) {
+    return std::max(wsNumDeques.load(std::memory_order_relaxed), deque->index + 1);
+}
+
+static void lWsPush(WsDeque *deque, WsRange *range) {
+    deque->Push(range);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (wsNumSleepers.load(std::memory_order_relaxed) > 0) {
+        wsEpoch.fetch_add(1, std::memory_order_release);
+        lFutexWake(&wsEpoch, 1);
+    }
+}
+
+/* Steals from some other deque, starting the scan at a different deque on
+   every call so thieves spread out. */
+static WsRange *lWsSteal(WsDeque *self) {
+    static std::atomic<uint32_t> nextStart(0);
+    int numDeques = wsNumDeques.load(std::memory_order_relaxed);
+    if (numDeques <= 1)
+        return nullptr;
+    int start = nextStart.fetch_add(1, std::memory_order_relaxed) % numDeques;
+
+    WsDeque *head = wsDeques.load(std::memory_order_acquire);
+    WsDeque *d = head;
+    for (int i = 0; i < start && d->next != nullptr; ++i)
+        d = d->next;
+    for (int i = 0; i < numDeques; ++i) {
+        if (d != self) {
+            WsRange *range = d->Steal();
+            if (range != nullptr)
+                return range;
+        }
+        d = d->next != nullptr ? d->next : head;
+    }
+    return nullptr;
+}
+
+static WsRange *lWsFindWork(WsDeque *deque) {
+    WsRange *range = deque->Take();
+    return range != nullptr ? range : lWsSteal(deque);
+}
+
+/* Splits off the upper half of the range for thieves until it is down to
+   its grain, then runs what is left. */
+static void lWsRunRange(WsRange *range) {
+    WsDeque *deque = lWsMyDeque();
+    while (range->end - range->begin > range->grain) {
+        int mid = range->begin + (range->end - range->begin) / 2;
+        WsRange *upper = deque->AllocRange();
+        *upper = *range;
+        upper->begin = mid;
+        range->end = mid;
+        lWsPush(deque, upper);
+    }
+
+    TaskInfo *ti = range->launch;
+    TaskGroup *tg = range->group;
+    int threadIndex = deque->index;
+    int threadCount = lWsThreadCount(deque);
+    int count = ti->taskCount();
+    for (int i = range->begin; i < range->end; ++i) {
+        ti->func(ti->data, threadIndex, threadCount, i, count, i % ti->taskCount0(),
+                 (i / ti->taskCount0()) % ti->taskCount1(), i / (ti->taskCount0() * ti->taskCount1()),
+                 ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+    }
+
+    int32_t done = 2 * (range->end - range->begin);
+    deque->FreeRange(range);
+    // The group may be synced and reused as soon as this lands; only the
+    // futex address is used afterwards
+    if (tg->numUnfinishedTasks.fetch_sub(done, std::memory_order_acq_rel) == done + 1)
+        lFutexWake(&tg->numUnfinishedTasks, INT_MAX);
+}
+
+static void *lWsWorkerEntry(void *) {
+    WsDeque *deque = lWsMyDeque();
+
+    int idleRounds = 0;
+    while (1) {
+        WsRange *range = lWsFindWork(deque);
+        if (range == nullptr && ++idleRounds >= WS_SPIN_ROUNDS) {
+            // Announce the sleep, then look once more so a push that missed
+            // the announcement is not missed here either
+            int32_t epoch = wsEpoch.load(std::memory_order_acquire);
+            wsNumSleepers.fetch_add(1, std::memory_order_seq_cst);
+            range = lWsSteal(deque);
+            if (range == nullptr)
+                lFutexWait(&wsEpoch, epoch);
+            wsNumSleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (range != nullptr) {
+            lWsRunRange(range);
+            idleRounds = 0;
+        }
+    }
+
+    pthread_exit(nullptr);
+    return 0;
+}
+
+static void InitTaskSystem() {
+    if (threads != nullptr)
+        return;
+
+    while (1) {
+        if (lAtomicCompareAndSwap32(&lock, 1, 0) == 0) {
+            if (threads == nullptr) {
+                // One fewer worker than cores: the syncing thread runs
+                // tasks too
+                int numWorkers = std::max(0, (int)sysconf(_SC_NPROCESSORS_ONLN) - 1);
+                pthread_t *workers = (pthread_t *)malloc(std::max(1, numWorkers) * sizeof(pthread_t));
+                nThreads = numWorkers;
+                for (int i = 0; i < numWorkers; ++i) {
+                    int err = pthread_create(&workers[i], nullptr, &lWsWorkerEntry, nullptr);
+                    if (err != 0) {
+                        fprintf(stderr, "Error creating pthread %d: %s\n", i, strerror(err));
+                        exit(1);
+                    }
+                }
+                lMemFence();
+                threads = workers;
+            }
+            lMemFence();
+            lock = 0;
+            break;
+        }
+    }
+}
+
+inline void TaskGroup::Launch(int baseIndex, int count) {
+    if (count == 0)
+        return;
+    numUnfinishedTasks.fetch_add(2 * count, std::memory_order_relaxed);
+
+    WsDeque *deque = lWsMyDeque();
+    WsRange *range = deque->AllocRange();
+    range->launch = GetTaskInfo(baseIndex);
+    range->group = this;
+    range->begin = 0;
+    range->end = count;
+    range->grain = std::max(1, count / (WS_RANGES_PER_THREAD * (nThreads + 1)));
+    lWsPush(deque, range);
+}
+
+inline void TaskGroup::Sync() {
+    WsDeque *deque = lWsMyDeque();
+    int idleRounds = 0;
+    while (1) {
+        int32_t unfinished = numUnfinishedTasks.load(std::memory_order_acquire);
+        if (unfinished <= 1)
+            break;
+
+        // Help: run our own tasks first, else steal
+        WsRange *range = lWsFindWork(deque);
+        if (range != nullptr) {
+            lWsRunRange(range);
+            idleRounds = 0;
+            continue;
+        }
+        if (++idleRounds < WS_SPIN_ROUNDS)
+            continue;
+
+        // Every remaining task is running elsewhere: sleep until the last
+        // one finishes
+        if ((unfinished & 1) == 0 &&
+            !numUnfinishedTasks.compare_exchange_strong(unfinished, unfinished | 1, std::memory_order_acq_rel))
+            continue;
+        lFutexWait(&numUnfinishedTasks, unfinished | 1);
+        idleRounds = 0;
+    }
+    numUnfinishedTasks.store(0, std::memory_order_relaxed);
+}
+
+#endif // ISPC_USE_WORKSTEALING
+
+///////////////////////////////////////////////////////////////////////////
+// LAB2 ITaskSystem
+
+#ifdef ISPC_USE_ITASKSYS
+
+static ITaskSystem *ispcTaskSystem = nullptr;
+
+void ISPCSetTaskSystem(ITaskSystem *taskSystem) { ispcTaskSystem = taskSystem; }
+
+ITaskSystem *ISPCGetTaskSystem() { return ispcTaskSystem; }
+
+static void InitTaskSystem() {
+    if (ispcTaskSystem == nullptr) {
+        fprintf(stderr, "ispc launch[] with ISPC_USE_ITASKSYS before ISPCSetTaskSystem() "
+                        "was called.  Exiting.\n");
+        exit(1);
+    }
+}
+
+/* All the tasks of one launch[], described by a single TaskInfo, as the
+   tasks of one bulk launch. ITaskSystem does not say which thread runs a
+   task, so as with TBB we pretend tasks and threads are 1:1. */
+class ISPCLaunchRunnable : public IRunnable {
+  public:
+    explicit ISPCLaunchRunnable(const TaskInfo *ti) : ti(ti) {}
+
+    void runTask(int taskIndex, int taskCount) {
+        int count0 = ti->taskCount0(), count1 = ti->taskCount1();
+        ti->func(ti->data, taskIndex, taskCount, taskIndex, taskCount, taskIndex % count0,
+                 (taskIndex / count0) % count1, taskIndex / (count0 * count1), count0, count1,
+                 ti->taskCount2());
+    }
+
+  private:
+    const TaskInfo *ti;
+};
+
+inline void TaskGroup::Launch(int baseIndex, int count) {
+    if (count == 0)
+        return;
+    ISPCLaunchRunnable runnable(GetTaskInfo(baseIndex));
+    ispcTaskSystem->run(&runnable, count);
+}
+
+inline void TaskGroup::Sync() {}
+
+#endif // ISPC_USE_ITASKSYS
 ///////////////////////////////////////////////////////////////////////////
 
 #ifndef ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
@@ -985,6 +1512,18 @@ void ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int cou
     } else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
+#if defined(ISPC_USE_WORKSTEALING) || defined(ISPC_USE_ITASKSYS)
+    // A single TaskInfo describes the whole launch; threads split its
+    // index range among themselves
+    int baseIndex = taskGroup->AllocTaskInfo(1);
+    TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex);
+    ti->func = (TaskFuncType)func;
+    ti->data = data;
+    ti->taskIndex = 0;
+    ti->taskCount3d[0] = count0;
+    ti->taskCount3d[1] = count1;
+    ti->taskCount3d[2] = count2;
+#else
     int baseIndex = taskGroup->AllocTaskInfo(count);
     for (int i = 0; i < count; ++i) {
         TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex + i);
@@ -995,6 +1534,7 @@ void ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int cou
         ti->taskCount3d[1] = count1;
         ti->taskCount3d[2] = count2;
     }
+#endif
     taskGroup->Launch(baseIndex, count);
 }
 
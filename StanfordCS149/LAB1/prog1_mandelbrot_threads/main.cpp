@@ -4,6 +4,7 @@
 #include <getopt.h>
 
 #include "CycleTimer.h"
+#include "perf_counters.h"
 
 extern void mandelbrotSerial(
     float x0, float y0, float x1, float y1,
@@ -17,7 +18,8 @@ extern void mandelbrotThread(
     float x0, float y0, float x1, float y1,
     int width, int height,
     int maxIterations,
-    int output[]);
+    int output[],
+    PerfCounts workerCounts[]);
 
 extern void writePPMImage(
     int *data,
@@ -46,6 +48,7 @@ void usage(const char *progname)
     printf("Program Options:\n");
     printf("  -t  --threads <N>  Use N threads\n");
     printf("  -v  --view <INT>   Use specified view settings\n");
+    printf("  -c  --counters     Report perf counters per run and per worker\n");
     printf("  -?  --help         This message\n");
 }
 
@@ -81,16 +84,20 @@ int run_tests(int num_threads, int argc, char **argv)
     float x1 = 1;
     float y0 = -1;
     float y1 = 1;
+    bool reportCounters = false;
 
     // parse commandline options ////////////////////////////////////////////
     int opt;
     static struct option long_options[] = {
         {"threads", 1, 0, 't'},
         {"view", 1, 0, 'v'},
+        {"counters", 0, 0, 'c'},
         {"help", 0, 0, '?'},
         {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "t:v:?", long_options, NULL)) != EOF)
+    // main() calls this once per thread count, so every call parses from the start
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "t:v:c?", long_options, NULL)) != EOF)
     {
 
         switch (opt)
@@ -118,12 +125,21 @@ int run_tests(int num_threads, int argc, char **argv)
             }
             break;
         }
+        case 'c':
+            reportCounters = true;
+            break;
         case '?':
         default:
             usage(argv[0]);
             return 1;
         }
     }
+    static bool reportedUnavailable = false;
+    if (reportCounters && !perfCountersAvailable() && !reportedUnavailable)
+    {
+        reportedUnavailable = true;
+        printf("(perf counters unavailable: %s)\n", PerfCounters::unavailableReason());
+    }
     int *output_serial = new int[width * height];
     int *output_thread = new int[width * height];
 
@@ -135,12 +151,19 @@ int run_tests(int num_threads, int argc, char **argv)
     //
     long double minSerial = 1e9;
     long double avgSerial = 0;
+    PerfCounts serialCounts;
     for (int i = 0; i < size; ++i)
     {
         memset(output_serial, 0, width * height * sizeof(int));
+        PerfCounters counters;
+        if (reportCounters)
+            counters.open(0, false);
+        counters.start();
         long double startTime = CycleTimer::currentSeconds();
         mandelbrotSerial(x0, y0, x1, y1, width, height, 0, height / 2, maxIterations, output_serial);
         long double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        serialCounts.add(counters.read());
         if ((endTime - startTime) > 0)
         {
             avgSerial += endTime - startTime;
@@ -152,7 +175,12 @@ int run_tests(int num_threads, int argc, char **argv)
         }
     }
     avgSerial /= size;
+    serialCounts.scale(1.0 / size);
     printf("[mandelbrot serial]:\t\t[%.3Lf] ms\n", avgSerial * 1000);
+    if (serialCounts.anyValid())
+    {
+        printPerfCounts("total", serialCounts);
+    }
     writePPMImage(output_serial, width, height, "mandelbrot-serial.ppm", maxIterations);
 
     //
@@ -161,12 +189,28 @@ int run_tests(int num_threads, int argc, char **argv)
 
     long double minThread = 1e30;
     long double avgThread = 0;
+    PerfCounts threadCounts;
+    std::vector<PerfCounts> workerCounts(numThreads);
     for (int i = 0; i < size; ++i)
     {
         memset(output_thread, 0, width * height * sizeof(int));
+        // inherited counts of the spawned workers are folded in when they
+        // are joined, so the total covers the whole call
+        PerfCounters counters;
+        if (reportCounters)
+            counters.open(0, true);
+        std::vector<PerfCounts> runWorkerCounts(numThreads);
+        counters.start();
         long double startTime = CycleTimer::currentSeconds();
-        mandelbrotThread(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread);
+        mandelbrotThread(numThreads, x0, y0, x1, y1, width, height, maxIterations, output_thread,
+                         reportCounters ? runWorkerCounts.data() : NULL);
         long double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        threadCounts.add(counters.read());
+        for (int w = 0; w < numThreads; w++)
+        {
+            workerCounts[w].add(runWorkerCounts[w]);
+        }
         if ((endTime - startTime) > 0)
         {
             avgThread += endTime - startTime;
@@ -178,8 +222,20 @@ int run_tests(int num_threads, int argc, char **argv)
         }
     }
     avgThread /= size;
+    threadCounts.scale(1.0 / size);
     // ghassen here : i changed the calculation from min to avg
     printf("[mandelbrot thread]:\t\t[%.3Lf] ms\n", avgThread * 1000);
+    if (threadCounts.anyValid())
+    {
+        printPerfCounts("total", threadCounts);
+        for (int w = 0; w < numThreads; w++)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), "worker %d", w);
+            workerCounts[w].scale(1.0 / size);
+            printPerfCounts(label, workerCounts[w]);
+        }
+    }
     writePPMImage(output_thread, width, height, "mandelbrot-thread.ppm", maxIterations);
 
     if (!verifyResult(output_serial, output_thread, width, height))
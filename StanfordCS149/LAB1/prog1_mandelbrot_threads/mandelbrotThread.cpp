@@ -2,6 +2,7 @@
 #include <thread>
 #include <atomic>
 #include "CycleTimer.h"
+#include "perf_counters.h"
 
 typedef struct
 {
@@ -14,6 +15,7 @@ typedef struct
     int threadId;
     int numThreads;
     std::atomic<int> *nextRow; // Added for dynamic work distribution
+    PerfCounts *counts;        // this worker's perf counts, or NULL
 } WorkerArgs;
 
 extern void mandelbrotSerial(
@@ -28,6 +30,13 @@ void workerThreadStart(WorkerArgs *const args)
     const int CHUNK_SIZE = 16;
     std::atomic<int> &nextRowIndex = *args->nextRow;
 
+    PerfCounters counters;
+    if (args->counts != NULL)
+    {
+        counters.open(0, false);
+        counters.start();
+    }
+
     while (true)
     {
         uint startRow = nextRowIndex.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
@@ -46,13 +55,20 @@ void workerThreadStart(WorkerArgs *const args)
             args->maxIterations,
             args->output);
     }
+
+    if (args->counts != NULL)
+    {
+        counters.stop();
+        *args->counts = counters.read();
+    }
 }
 
 void mandelbrotThread(
     int numThreads,
     float x0, float y0, float x1, float y1,
     int width, int height,
-    int maxIterations, int output[])
+    int maxIterations, int output[],
+    PerfCounts workerCounts[])
 {
     static constexpr int MAX_THREADS = 64;
 
@@ -80,6 +96,7 @@ void mandelbrotThread(
         args[i].output = output;
         args[i].threadId = i;
         args[i].nextRow = &nextRow; // Share the atomic counter
+        args[i].counts = workerCounts != NULL ? &workerCounts[i] : NULL;
     }
 
     // Spawn all worker threads (including the main thread)
@@ -3,6 +3,7 @@
 #include <getopt.h>
 
 #include "CycleTimer.h"
+#include "perf_counters.h"
 #include "mandelbrot_ispc.h"
 
 extern void mandelbrotSerial(
@@ -65,6 +66,7 @@ void usage(const char* progname) {
     printf("Program Options:\n");
     printf("  -t  --tasks        Run ISPC code implementation with tasks\n");
     printf("  -v  --view <INT>   Use specified view settings\n");
+    printf("  -c  --counters     Report perf counters per run and per worker\n");
     printf("  -?  --help         This message\n");
 }
 
@@ -81,17 +83,19 @@ int main(int argc, char** argv) {
     float y1 = 1;
 
     bool useTasks = false;
+    bool reportCounters = false;
 
     // parse commandline options ////////////////////////////////////////////
     int opt;
     static struct option long_options[] = {
         {"tasks", 0, 0, 't'},
         {"view",  1, 0, 'v'},
+        {"counters", 0, 0, 'c'},
         {"help",  0, 0, '?'},
         {0 ,0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "tv:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "tv:c?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 't':
@@ -112,6 +116,9 @@ int main(int argc, char** argv) {
             }
             break;
         }
+        case 'c':
+            reportCounters = true;
+            break;
         case '?':
         default:
             usage(argv[0]);
@@ -127,19 +134,32 @@ int main(int argc, char** argv) {
     for (unsigned int i = 0; i < width * height; ++i)
         output_serial[i] = 0;
 
+    if (reportCounters && !perfCountersAvailable())
+        printf("(perf counters unavailable: %s)\n", PerfCounters::unavailableReason());
+
     //
     // Run the serial implementation. Teport the minimum time of three
     // runs for robust timing.
     //
     double minSerial = 1e30;
+    PerfCounts serialCounts;
     for (int i = 0; i < 3; ++i) {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         mandelbrotSerial(x0, y0, x1, y1, width, height, 0, height, maxIterations, output_serial);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minSerial)
+            serialCounts = counters.read();
         minSerial = std::min(minSerial, endTime - startTime);
     }
 
     printf("[mandelbrot serial]:\t\t[%.3f] ms\n", minSerial * 1000);
+    if (serialCounts.anyValid())
+        printPerfCounts("total", serialCounts);
     writePPMImage(output_serial, width, height, "mandelbrot-serial.ppm", maxIterations);
 
     // Clear out the buffer
@@ -150,14 +170,24 @@ int main(int argc, char** argv) {
     // Compute the image using the ispc implementation
     //
     double minISPC = 1e30;
+    PerfCounts ispcCounts;
     for (int i = 0; i < 3; ++i) {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         mandelbrot_ispc(x0, y0, x1, y1, width, height, maxIterations, output_ispc);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minISPC)
+            ispcCounts = counters.read();
         minISPC = std::min(minISPC, endTime - startTime);
     }
 
     printf("[mandelbrot ispc]:\t\t[%.3f] ms\n", minISPC * 1000);
+    if (ispcCounts.anyValid())
+        printPerfCounts("total", ispcCounts);
     writePPMImage(output_ispc, width, height, "mandelbrot-ispc.ppm", maxIterations);
 
 
@@ -181,14 +211,34 @@ int main(int argc, char** argv) {
         //
         // Tasking version of the ISPC code
         //
+        PerfCounts taskCounts;
+        std::vector<PerfCounts> taskWorkerCounts;
         for (int i = 0; i < 3; ++i) {
+            PerfCounters counters;
+            if (reportCounters)
+                openProcessThreads(&counters);
+            counters.start();
             double startTime = CycleTimer::currentSeconds();
             mandelbrot_ispc_withtasks(x0, y0, x1, y1, width, height, maxIterations, output_ispc_tasks);
             double endTime = CycleTimer::currentSeconds();
+            counters.stop();
+            if (endTime - startTime < minTaskISPC) {
+                taskCounts = counters.read();
+                taskWorkerCounts.clear();
+                for (int w = 1; w < counters.numThreads(); w++)
+                    taskWorkerCounts.push_back(counters.readThread(w));
+            }
             minTaskISPC = std::min(minTaskISPC, endTime - startTime);
         }
 
         printf("[mandelbrot multicore ispc]:\t[%.3f] ms\n", minTaskISPC * 1000);
+        if (taskCounts.anyValid())
+            printPerfCounts("total", taskCounts);
+        for (size_t w = 0; w < taskWorkerCounts.size(); w++) {
+            char label[32];
+            snprintf(label, sizeof(label), "worker %d", (int) w);
+            printPerfCounts(label, taskWorkerCounts[w]);
+        }
         writePPMImage(output_ispc_tasks, width, height, "mandelbrot-task-ispc.ppm", maxIterations);
 
         if (! verifyResult (output_serial, output_ispc_tasks, width, height)) {
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <algorithm>
+#include <getopt.h>
 #include <pthread.h>
 #include <math.h>
 
 #include "CycleTimer.h"
+#include "perf_counters.h"
 #include "sqrt_ispc.h"
 
 using namespace ispc;
@@ -21,8 +23,39 @@ static void verifyResult(int N, float *result, float *gold)
     }
 }
 
-int main()
+static void usage(const char *progname)
 {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -c  --counters     Report perf counters per run and per worker\n");
+    printf("  -?  --help         This message\n");
+}
+
+int main(int argc, char **argv)
+{
+
+    bool reportCounters = false;
+
+    // parse commandline options ////////////////////////////////////////////
+    int opt;
+    static struct option long_options[] = {
+        {"counters", 0, 0, 'c'},
+        {"help", 0, 0, '?'},
+        {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "c?", long_options, NULL)) != EOF)
+    {
+        switch (opt)
+        {
+        case 'c':
+            reportCounters = true;
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     const unsigned int N = 20 * 1000 * 1000;
     const float initialGuess = 1.0f;
@@ -46,20 +79,35 @@ int main()
     for (unsigned int i = 0; i < N; i++)
         gold[i] = sqrt(values[i]);
 
+    if (reportCounters && !perfCountersAvailable())
+        printf("(perf counters unavailable: %s)\n", PerfCounters::unavailableReason());
+
     //
     // And run the serial implementation 3 times, again reporting the
     // minimum time.
     //
     double minSerial = 1e30;
+    PerfCounts serialCounts;
     for (int i = 0; i < 3; ++i)
     {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         sqrtSerial(N, initialGuess, values, output);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minSerial)
+        {
+            serialCounts = counters.read();
+        }
         minSerial = std::min(minSerial, endTime - startTime);
     }
 
     printf("[sqrt serial]:\t\t[%.3f] ms\n", minSerial * 1000);
+    if (serialCounts.anyValid())
+        printPerfCounts("total", serialCounts);
 
     verifyResult(N, output, gold);
 
@@ -68,15 +116,27 @@ int main()
     // time of three runs.
     //
     double minISPC = 1e30;
+    PerfCounts ispcCounts;
     for (int i = 0; i < 3; ++i)
     {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         sqrt_ispc(N, initialGuess, values, output);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minISPC)
+        {
+            ispcCounts = counters.read();
+        }
         minISPC = std::min(minISPC, endTime - startTime);
     }
 
     printf("[sqrt ispc]:\t\t[%.3f] ms\n", minISPC * 1000);
+    if (ispcCounts.anyValid())
+        printPerfCounts("total", ispcCounts);
 
     verifyResult(N, output, gold);
 
@@ -88,15 +148,37 @@ int main()
     // Tasking version of the ISPC code
     //
     double minTaskISPC = 1e30;
+    PerfCounts taskCounts;
+    std::vector<PerfCounts> taskWorkerCounts;
     for (int i = 0; i < 3; ++i)
     {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         sqrt_ispc_withtasks(N, initialGuess, values, output);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minTaskISPC)
+        {
+            taskCounts = counters.read();
+            taskWorkerCounts.clear();
+            for (int w = 1; w < counters.numThreads(); w++)
+                taskWorkerCounts.push_back(counters.readThread(w));
+        }
         minTaskISPC = std::min(minTaskISPC, endTime - startTime);
     }
 
     printf("[sqrt task ispc]:\t[%.3f] ms\n", minTaskISPC * 1000);
+    if (taskCounts.anyValid())
+        printPerfCounts("total", taskCounts);
+    for (size_t w = 0; w < taskWorkerCounts.size(); w++)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "worker %d", (int) w);
+        printPerfCounts(label, taskWorkerCounts[w]);
+    }
 
     verifyResult(N, output, gold);
 
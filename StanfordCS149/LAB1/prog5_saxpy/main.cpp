@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <algorithm>
+#include <getopt.h>
 
 #include "CycleTimer.h"
+#include "perf_counters.h"
 #include "saxpy_ispc.h"
 
 extern void saxpySerial(int N, float a, float *X, float *Y, float *result);
@@ -32,8 +34,39 @@ static void verifyResult(int N, float *result, float *gold)
 
 using namespace ispc;
 
-int main()
+static void usage(const char *progname)
 {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -c  --counters     Report perf counters per run and per worker\n");
+    printf("  -?  --help         This message\n");
+}
+
+int main(int argc, char **argv)
+{
+
+    bool reportCounters = false;
+
+    // parse commandline options ////////////////////////////////////////////
+    int opt;
+    static struct option long_options[] = {
+        {"counters", 0, 0, 'c'},
+        {"help", 0, 0, '?'},
+        {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "c?", long_options, NULL)) != EOF)
+    {
+        switch (opt)
+        {
+        case 'c':
+            reportCounters = true;
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     const unsigned int N = 20 * 1000 * 1000; // 20 M element vectors (~80 MB)
     const unsigned int TOTAL_BYTES = 4 * N * sizeof(float);
@@ -57,6 +90,9 @@ int main()
         resultTasks[i] = 0.f;
     }
 
+    if (reportCounters && !perfCountersAvailable())
+        printf("(perf counters unavailable: %s)\n", PerfCounters::unavailableReason());
+
     //
     // Run the serial implementation. Repeat three times for robust
     // timing.
@@ -79,11 +115,21 @@ int main()
     // Run the ISPC (single core) implementation
     //
     double minISPC = 1e30;
+    PerfCounts ispcCounts;
     for (int i = 0; i < 3; ++i)
     {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         saxpy_ispc(N, scale, arrayX, arrayY, resultISPC);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minISPC)
+        {
+            ispcCounts = counters.read();
+        }
         minISPC = std::min(minISPC, endTime - startTime);
     }
 
@@ -93,16 +139,32 @@ int main()
            minISPC * 1000,
            toBW(TOTAL_BYTES, minISPC),
            toGFLOPS(TOTAL_FLOPS, minISPC));
+    if (ispcCounts.anyValid())
+        printPerfCounts("total", ispcCounts);
 
     //
     // Run the ISPC (multi-core) implementation
     //
     double minTaskISPC = 1e30;
+    PerfCounts taskCounts;
+    std::vector<PerfCounts> taskWorkerCounts;
     for (int i = 0; i < 3; ++i)
     {
+        PerfCounters counters;
+        if (reportCounters)
+            openProcessThreads(&counters);
+        counters.start();
         double startTime = CycleTimer::currentSeconds();
         saxpy_ispc_withtasks(N, scale, arrayX, arrayY, resultTasks);
         double endTime = CycleTimer::currentSeconds();
+        counters.stop();
+        if (endTime - startTime < minTaskISPC)
+        {
+            taskCounts = counters.read();
+            taskWorkerCounts.clear();
+            for (int w = 1; w < counters.numThreads(); w++)
+                taskWorkerCounts.push_back(counters.readThread(w));
+        }
         minTaskISPC = std::min(minTaskISPC, endTime - startTime);
     }
 
@@ -112,6 +174,14 @@ int main()
            minTaskISPC * 1000,
            toBW(TOTAL_BYTES, minTaskISPC),
            toGFLOPS(TOTAL_FLOPS, minTaskISPC));
+    if (taskCounts.anyValid())
+        printPerfCounts("total", taskCounts);
+    for (size_t w = 0; w < taskWorkerCounts.size(); w++)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "worker %d", (int) w);
+        printPerfCounts(label, taskWorkerCounts[w]);
+    }
 
     printf("\t\t\t\t(%.2fx speedup from use of tasks)\n", minISPC / minTaskISPC);
     // printf("\t\t\t\t(%.2fx speedup from ISPC)\n", minSerial/minISPC);
@@ -0,0 +1,110 @@
+#ifndef _CORO_TASKSYS_H
+#define _CORO_TASKSYS_H
+
+/*
+ * C++20 coroutine front end for ITaskSystem. Only available when building
+ * with -std=c++20 (`make CXXSTD=c++20`); with older standards this header
+ * is empty.
+ *
+ *   LaunchChain handleRequest(ITaskSystem* t, ...) {
+ *       TaskID a = co_await run_async(t, &decode, 64);
+ *       TaskID b = co_await run_async(t, &transform, 64, {a});
+ *       co_await run_async(t, &encode, 16, {b});
+ *   }
+ *
+ *   for (...) handleRequest(t, ...);   // each call returns at its first co_await
+ *   t->sync();                         // waits for every chain to finish
+ *
+ * `co_await run_async(...)` submits the bulk launch with runAsyncWithDeps()
+ * and suspends the coroutine. A one-task continuation launch that depends
+ * on it (see ResumeRunnable) resumes the coroutine on a task system thread
+ * once the launch is complete, so no thread is blocked per chain. The
+ * awaited value is the launch's TaskID, usable as a dependency of later
+ * launches.
+ *
+ * Because each continuation submits its next launch before its own task
+ * finishes, sync() only returns once every chain has run to completion.
+ */
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include "itasksys.h"
+
+/*
+ * Return type for coroutines that drive launches. Chains start running
+ * immediately and free themselves when they finish; wait for them with
+ * ITaskSystem::sync().
+ */
+class LaunchChain {
+    public:
+        struct promise_type {
+            LaunchChain get_return_object() { return LaunchChain(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+};
+
+/*
+ * Runnable of a continuation launch: its single task resumes a suspended
+ * coroutine. It is heap-allocated rather than kept in the coroutine frame,
+ * which the resumed coroutine may destroy while the launch is still in
+ * flight, and frees itself once its task has run, the last time the task
+ * system uses it.
+ */
+class ResumeRunnable: public IRunnable {
+    public:
+        explicit ResumeRunnable(std::coroutine_handle<> handle) : handle_(handle) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            handle_.resume();
+            delete this;
+        }
+
+    private:
+        std::coroutine_handle<> handle_;
+};
+
+/*
+ * Awaiter returned by run_async(): submits the launch and a continuation
+ * launch depending on it, which resumes the coroutine.
+ */
+class LaunchAwaiter {
+    public:
+        LaunchAwaiter(ITaskSystem* t, IRunnable* runnable, int num_total_tasks,
+                      const std::vector<TaskID>& deps)
+            : t_(t), runnable_(runnable), num_total_tasks_(num_total_tasks),
+              deps_(deps), id_(-1) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            id_ = t_->runAsyncWithDeps(runnable_, num_total_tasks_, deps_);
+            // the coroutine may be resumed (and this awaiter destroyed)
+            // before the call below returns: touch no members after it
+            ITaskSystem* t = t_;
+            std::vector<TaskID> continuation_deps(1, id_);
+            t->runAsyncWithDeps(new ResumeRunnable(handle), 1, continuation_deps);
+        }
+
+        TaskID await_resume() const noexcept { return id_; }
+
+    private:
+        ITaskSystem* t_;
+        IRunnable* runnable_;
+        int num_total_tasks_;
+        std::vector<TaskID> deps_;
+        TaskID id_;
+};
+
+inline LaunchAwaiter run_async(ITaskSystem* t, IRunnable* runnable, int num_total_tasks,
+                               const std::vector<TaskID>& deps = std::vector<TaskID>()) {
+    return LaunchAwaiter(t, runnable, num_total_tasks, deps);
+}
+
+#endif
+
+#endif
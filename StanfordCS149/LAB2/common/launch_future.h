@@ -0,0 +1,78 @@
+#ifndef _LAUNCH_FUTURE_H
+#define _LAUNCH_FUTURE_H
+
+#include <vector>
+#include "itasksys.h"
+
+/*
+ * LaunchFuture: handle to an asynchronous bulk task launch that later
+ * launches can be chained onto, instead of collecting TaskIDs into
+ * dependency vectors by hand.
+ *
+ *   LaunchFuture a = launch_async(t, &produce, 64);
+ *   LaunchFuture b = a.then(&transform, 64).then(&filter, 64);
+ *   LaunchFuture c = launch_async(t, &other, 16);
+ *   when_all(b, c).then(&combine, 1);
+ *   t->sync();
+ *
+ * then() submits through ITaskSystem::runAsyncAfter(), so each link of a
+ * chain is attached directly as a successor of its predecessor with no
+ * dependency vector. Completion is observed with ITaskSystem::sync().
+ */
+class LaunchFuture {
+    public:
+        LaunchFuture(ITaskSystem* t, TaskID id) : t_(t), id_(id) {}
+
+        TaskID id() const { return id_; }
+        ITaskSystem* taskSystem() const { return t_; }
+
+        /*
+          Launches num_total_tasks tasks of runnable once this launch has
+          completed.
+         */
+        LaunchFuture then(IRunnable* runnable, int num_total_tasks) const {
+            return LaunchFuture(t_, t_->runAsyncAfter(runnable, num_total_tasks, id_));
+        }
+
+    private:
+        ITaskSystem* t_;
+        TaskID id_;
+};
+
+inline LaunchFuture launch_async(ITaskSystem* t, IRunnable* runnable, int num_total_tasks,
+                                 const std::vector<TaskID>& deps = std::vector<TaskID>()) {
+    return LaunchFuture(t, t->runAsyncWithDeps(runnable, num_total_tasks, deps));
+}
+
+/*
+ * Runnable of the empty join launches issued by when_all().
+ */
+class JoinRunnable: public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {}
+};
+
+/*
+ * Returns a future that completes once all of `futures` (which must be
+ * non-empty and share a task system) have. Implemented as a zero-task
+ * launch depending on every input.
+ */
+inline LaunchFuture when_all(const std::vector<LaunchFuture>& futures) {
+    static JoinRunnable join;
+    ITaskSystem* t = futures[0].taskSystem();
+    std::vector<TaskID> deps;
+    deps.reserve(futures.size());
+    for (const LaunchFuture& f : futures) {
+        deps.push_back(f.id());
+    }
+    return LaunchFuture(t, t->runAsyncWithDeps(&join, 0, deps));
+}
+
+inline LaunchFuture when_all(const LaunchFuture& a, const LaunchFuture& b) {
+    std::vector<LaunchFuture> futures;
+    futures.push_back(a);
+    futures.push_back(b);
+    return when_all(futures);
+}
+
+#endif
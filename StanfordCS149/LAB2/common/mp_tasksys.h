@@ -0,0 +1,443 @@
+#ifndef _MP_TASKSYS_H
+#define _MP_TASKSYS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <errno.h>
+#include <pthread.h>
+#include <new>
+#include <stdio.h>
+#include <vector>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "itasksys.h"
+
+/*
+ * TaskSystemMultiProcess: an ITaskSystem whose workers are forked
+ * processes, so a runnable that crashes takes down one worker process
+ * rather than the caller.
+ *
+ * All scheduling state (launch table, ready queue, dependency edges and
+ * completion counters) lives in one shared memory segment mapped before
+ * the workers are forked. Waiting is done with futexes on counters in that
+ * segment (on platforms without futexes, by polling).
+ *
+ * Since workers run in their own address spaces:
+ *  - runnables must be registered with registerRunnable() before the
+ *    first launch (that is when the workers are forked); launches name
+ *    them by pointer as usual and the workers look them up by ID;
+ *  - everything a task writes that the caller needs to see must live in
+ *    memory from allocShared(), also allocated before the first launch.
+ *
+ *   TaskSystemMultiProcess mp(8);
+ *   int* out = (int*) TaskSystemMultiProcess::allocShared(n * sizeof(int));
+ *   MyTask task(out);
+ *   mp.registerRunnable(&task);
+ *   mp.run(&task, 64);
+ *
+ * A task whose worker dies is counted as finished and reported in
+ * numFailedTasks(), and the worker is replaced, so sync() still returns.
+ */
+
+const int MP_MAX_LAUNCHES = 4096;   // launches in flight at once
+const int MP_MAX_EDGES = 65536;     // dependencies on unfinished launches at once
+const int MP_MAX_WORKERS = 256;
+
+// how often waiting callers check for dead workers, in nanoseconds
+const long MP_REAP_INTERVAL_NS = 10 * 1000 * 1000;
+
+inline void mpFutexWait(std::atomic<int>* addr, int expected, long timeout_ns) {
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000L;
+    ts.tv_nsec = timeout_ns % 1000000000L;
+    syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT, expected,
+            timeout_ns > 0 ? &ts : NULL, NULL, 0);
+#else
+    if (addr->load() == expected) usleep(50);
+#endif
+}
+
+inline void mpFutexWake(std::atomic<int>* addr, int num_waiters) {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE, num_waiters, NULL, NULL, 0);
+#endif
+}
+
+/*
+ * One bulk launch in the shared launch table, at slot id_ % MP_MAX_LAUNCHES.
+ */
+struct MpLaunch {
+    TaskID id_;
+    int runnable_id_;
+    int num_total_tasks_;
+    int next_task_;
+    int tasks_done_;
+    int num_pending_deps_;
+    int first_edge_;    // successors, linked through MpEdge::next_
+    bool done_;
+};
+
+struct MpEdge {
+    int successor_slot_;
+    int next_;          // next edge of the same predecessor, or of the free list
+};
+
+/*
+ * The shared segment. Everything but the futex words is guarded by lock_.
+ */
+struct MpShared {
+    pthread_mutex_t lock_;         // process-shared; robust where supported
+    std::atomic<int> work_seq_;    // bumped when a launch becomes ready
+    std::atomic<int> done_seq_;    // bumped when a launch completes
+    bool stop_;
+    int num_in_flight_;
+    int ready_[MP_MAX_LAUNCHES];   // ring of slots with unclaimed tasks
+    int ready_head_;
+    int num_ready_;
+    int free_edge_;
+    int num_free_edges_;
+    int num_failed_tasks_;
+    int running_slot_[MP_MAX_WORKERS];  // launch slot of each worker's current task, or -1
+    int running_task_[MP_MAX_WORKERS];
+    MpLaunch launches_[MP_MAX_LAUNCHES];
+    MpEdge edges_[MP_MAX_EDGES];
+};
+
+class TaskSystemMultiProcess: public ITaskSystem {
+    public:
+        TaskSystemMultiProcess(int num_threads)
+            : ITaskSystem(num_threads), num_workers_(std::min(std::max(num_threads, 1), MP_MAX_WORKERS)),
+              next_id_(0), started_(false) {
+            shared_ = static_cast<MpShared*>(allocShared(sizeof(MpShared)));
+            new (shared_) MpShared();
+            initLock();
+            shared_->work_seq_ = 0;
+            shared_->done_seq_ = 0;
+            shared_->stop_ = false;
+            shared_->num_in_flight_ = 0;
+            shared_->ready_head_ = 0;
+            shared_->num_ready_ = 0;
+            shared_->num_failed_tasks_ = 0;
+            for (int i = 0; i < MP_MAX_LAUNCHES; i++) {
+                shared_->launches_[i].id_ = -1;
+                shared_->launches_[i].done_ = true;
+            }
+            for (int i = 0; i < MP_MAX_EDGES; i++) {
+                shared_->edges_[i].next_ = i + 1 < MP_MAX_EDGES ? i + 1 : -1;
+            }
+            shared_->free_edge_ = 0;
+            shared_->num_free_edges_ = MP_MAX_EDGES;
+            for (int w = 0; w < MP_MAX_WORKERS; w++) {
+                shared_->running_slot_[w] = -1;
+            }
+        }
+
+        ~TaskSystemMultiProcess() {
+            if (started_) {
+                lock();
+                shared_->stop_ = true;
+                shared_->work_seq_++;
+                unlock();
+                mpFutexWake(&shared_->work_seq_, num_workers_);
+                for (pid_t pid : pids_) {
+                    waitpid(pid, NULL, 0);
+                }
+            }
+            pthread_mutex_destroy(&shared_->lock_);
+            shared_->~MpShared();
+            freeShared(shared_, sizeof(MpShared));
+        }
+
+        const char* name() { return "Multi-Process"; }
+        int numThreads() { return num_workers_; }
+
+        /*
+          Memory visible to the caller and every worker process. Must be
+          allocated before the task system's first launch.
+         */
+        static void* allocShared(size_t bytes) {
+            void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            assert(p != MAP_FAILED);
+            return p;
+        }
+
+        static void freeShared(void* p, size_t bytes) {
+            munmap(p, bytes);
+        }
+
+        /*
+          Makes `runnable` launchable and returns its ID. Must be called
+          before the first launch.
+         */
+        int registerRunnable(IRunnable* runnable) {
+            assert(!started_ && "register runnables before the first launch");
+            runnables_.push_back(runnable);
+            return runnables_.size() - 1;
+        }
+
+        int numFailedTasks() {
+            lock();
+            int n = shared_->num_failed_tasks_;
+            unlock();
+            return n;
+        }
+
+        void run(IRunnable* runnable, int num_total_tasks) {
+            TaskID id = runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>());
+            MpLaunch& launch = shared_->launches_[id % MP_MAX_LAUNCHES];
+            waitUntil([&launch, id] { return launch.id_ != id || launch.done_; });
+        }
+
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps) {
+            int runnable_id = runnableId(runnable);
+            start();
+
+            TaskID id = next_id_++;
+            int slot = id % MP_MAX_LAUNCHES;
+            MpShared* s = shared_;
+            int num_deps = deps.size();
+            // wait for the slot (and enough edges) to be released
+            waitUntil([s, slot, num_deps] {
+                return s->launches_[slot].done_ && s->num_free_edges_ >= num_deps;
+            });
+
+            lock();
+            MpLaunch& launch = s->launches_[slot];
+            launch.id_ = id;
+            launch.runnable_id_ = runnable_id;
+            launch.num_total_tasks_ = num_total_tasks;
+            launch.next_task_ = 0;
+            launch.tasks_done_ = 0;
+            launch.num_pending_deps_ = 0;
+            launch.first_edge_ = -1;
+            launch.done_ = false;
+            s->num_in_flight_++;
+            for (TaskID dep : deps) {
+                MpLaunch& predecessor = s->launches_[dep % MP_MAX_LAUNCHES];
+                // a reused or finished slot means `dep` is done
+                if (predecessor.id_ != dep || predecessor.done_) continue;
+                int e = s->free_edge_;
+                s->free_edge_ = s->edges_[e].next_;
+                s->num_free_edges_--;
+                s->edges_[e].successor_slot_ = slot;
+                s->edges_[e].next_ = predecessor.first_edge_;
+                predecessor.first_edge_ = e;
+                launch.num_pending_deps_++;
+            }
+            if (launch.num_pending_deps_ == 0) {
+                makeReady(slot);
+            }
+            unlock();
+            wakeAll();
+            return id;
+        }
+
+        void sync() {
+            if (!started_) return;
+            MpShared* s = shared_;
+            waitUntil([s] { return s->num_in_flight_ == 0; });
+        }
+
+    private:
+        int runnableId(IRunnable* runnable) const {
+            for (size_t i = 0; i < runnables_.size(); i++) {
+                if (runnables_[i] == runnable) return i;
+            }
+            assert(!"runnable was not registered with registerRunnable()");
+            return -1;
+        }
+
+        // A worker killed while holding lock_ (SIGKILL, the OOM killer)
+        // must not leave the caller blocked in lock(), where reapWorkers()
+        // could never replace it, so lock_ is a robust mutex on Linux.
+        void initLock() {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+            pthread_mutex_init(&shared_->lock_, &attr);
+            pthread_mutexattr_destroy(&attr);
+        }
+
+        void lock() {
+            int rc = pthread_mutex_lock(&shared_->lock_);
+#if defined(__linux__)
+            if (rc == EOWNERDEAD) {
+                // the owner died; its task, if any, is still recorded in
+                // running_slot_ and is failed by reapWorkers()
+                pthread_mutex_consistent(&shared_->lock_);
+                rc = 0;
+            }
+#endif
+            assert(rc == 0);
+            (void) rc;
+        }
+
+        void unlock() {
+            pthread_mutex_unlock(&shared_->lock_);
+        }
+
+        void wakeAll() {
+            mpFutexWake(&shared_->work_seq_, num_workers_);
+            mpFutexWake(&shared_->done_seq_, 1);
+        }
+
+        // Forks the workers on the first launch, once every runnable and
+        // shared buffer exists.
+        void start() {
+            if (started_) return;
+            started_ = true;
+            for (int w = 0; w < num_workers_; w++) {
+                pids_.push_back(spawnWorker(w));
+            }
+        }
+
+        pid_t spawnWorker(int w) {
+            fflush(stdout);
+            fflush(stderr);
+            pid_t pid = fork();
+            assert(pid >= 0);
+            if (pid == 0) {
+                workerMain(w);
+                _exit(0);
+            }
+            return pid;
+        }
+
+        // Blocks the caller until cond() holds (checked under the lock),
+        // replacing workers that died in the meantime.
+        template <typename Cond>
+        void waitUntil(const Cond& cond) {
+            while (true) {
+                lock();
+                bool met = cond();
+                int seq = shared_->done_seq_;
+                unlock();
+                if (met) return;
+                mpFutexWait(&shared_->done_seq_, seq, MP_REAP_INTERVAL_NS);
+                reapWorkers();
+            }
+        }
+
+        void reapWorkers() {
+            for (int w = 0; w < num_workers_; w++) {
+                int status;
+                if (waitpid(pids_[w], &status, WNOHANG) != pids_[w]) continue;
+                lock();
+                int slot = shared_->running_slot_[w];
+                if (slot >= 0) {
+                    MpLaunch& launch = shared_->launches_[slot];
+                    fprintf(stderr, "Worker process %d died running task %d of launch %d\n",
+                            (int) pids_[w], shared_->running_task_[w], launch.id_);
+                    shared_->running_slot_[w] = -1;
+                    shared_->num_failed_tasks_++;
+                    finishTask(slot);
+                }
+                unlock();
+                wakeAll();
+                pids_[w] = spawnWorker(w);
+            }
+        }
+
+        void workerMain(int w) {
+            MpShared* s = shared_;
+            lock();
+            while (!s->stop_) {
+                if (s->num_ready_ == 0) {
+                    int seq = s->work_seq_;
+                    unlock();
+                    mpFutexWait(&s->work_seq_, seq, 0);
+                    lock();
+                    continue;
+                }
+                int slot = s->ready_[s->ready_head_];
+                MpLaunch& launch = s->launches_[slot];
+                int task_id = launch.next_task_++;
+                if (launch.next_task_ == launch.num_total_tasks_) {
+                    s->ready_head_ = (s->ready_head_ + 1) % MP_MAX_LAUNCHES;
+                    s->num_ready_--;
+                }
+                s->running_slot_[w] = slot;
+                s->running_task_[w] = task_id;
+                IRunnable* runnable = runnables_[launch.runnable_id_];
+                int num_total_tasks = launch.num_total_tasks_;
+                unlock();
+
+                runnable->runTask(task_id, num_total_tasks);
+
+                lock();
+                s->running_slot_[w] = -1;
+                int done_before = s->done_seq_;
+                finishTask(slot);
+                if (s->done_seq_ != done_before) {
+                    unlock();
+                    wakeAll();
+                    lock();
+                }
+            }
+            unlock();
+        }
+
+        // The helpers below must be called with the lock held.
+
+        void makeReady(int slot) {
+            MpShared* s = shared_;
+            if (s->launches_[slot].num_total_tasks_ == 0) {
+                finishLaunch(slot);
+                return;
+            }
+            s->ready_[(s->ready_head_ + s->num_ready_) % MP_MAX_LAUNCHES] = slot;
+            s->num_ready_++;
+            s->work_seq_++;
+        }
+
+        void finishTask(int slot) {
+            MpLaunch& launch = shared_->launches_[slot];
+            if (++launch.tasks_done_ == launch.num_total_tasks_) {
+                finishLaunch(slot);
+            }
+        }
+
+        void finishLaunch(int slot) {
+            MpShared* s = shared_;
+            MpLaunch& launch = s->launches_[slot];
+            launch.done_ = true;
+            s->num_in_flight_--;
+            s->done_seq_++;
+            int e = launch.first_edge_;
+            while (e >= 0) {
+                int next = s->edges_[e].next_;
+                int successor = s->edges_[e].successor_slot_;
+                s->edges_[e].next_ = s->free_edge_;
+                s->free_edge_ = e;
+                s->num_free_edges_++;
+                if (--s->launches_[successor].num_pending_deps_ == 0) {
+                    makeReady(successor);
+                }
+                e = next;
+            }
+            launch.first_edge_ = -1;
+        }
+
+        MpShared* shared_;
+        std::vector<IRunnable*> runnables_;
+        std::vector<pid_t> pids_;
+        int num_workers_;
+        TaskID next_id_;
+        bool started_;
+};
+
+#endif
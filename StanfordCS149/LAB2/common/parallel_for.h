@@ -0,0 +1,111 @@
+#ifndef _PARALLEL_FOR_H
+#define _PARALLEL_FOR_H
+
+#include <algorithm>
+#include "itasksys.h"
+
+/*
+ * Loop templates layered over ITaskSystem. Instead of writing an IRunnable
+ * subclass per workload, pass a lambda or functor:
+ *
+ *   parallel_for(t, n, grain, [&](int i) { out[i] = f(in[i]); });
+ *   parallel_for_range(t, 0, n, [&](TaskRange r) {
+ *       for (int i = r.begin; i < r.end; i++) out[i] = f(in[i]);
+ *   });
+ *
+ * Each bulk task covers a chunk of `grain` consecutive indices, so the
+ * virtual runTask() call is paid once per chunk while the body is a
+ * template parameter that the compiler inlines into the chunk loop.
+ * Both calls are synchronous (they use ITaskSystem::run()).
+ */
+
+/*
+ * Half-open index interval [begin, end) handed to range bodies.
+ */
+struct TaskRange {
+    int begin;
+    int end;
+    TaskRange(int b, int e) : begin(b), end(e) {}
+    int size() const { return end - begin; }
+};
+
+// chunks per launch when the caller passes grain <= 0
+const int PARALLEL_FOR_DEFAULT_CHUNKS = 64;
+
+inline int parallelForGrain(int num_elements, int grain) {
+    if (grain > 0) return grain;
+    return std::max(1, (num_elements + PARALLEL_FOR_DEFAULT_CHUNKS - 1) /
+                       PARALLEL_FOR_DEFAULT_CHUNKS);
+}
+
+/*
+ * Adapts a range body to IRunnable: task i runs body over the i-th chunk
+ * of [begin, end).
+ */
+template <typename RangeBody>
+class RangeRunnable: public IRunnable {
+    public:
+        RangeRunnable(int begin, int end, int grain, const RangeBody& body)
+            : begin_(begin), end_(end), grain_(grain), body_(body) {}
+        ~RangeRunnable() {}
+
+        int numChunks() const {
+            return (end_ - begin_ + grain_ - 1) / grain_;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            int lo = begin_ + task_id * grain_;
+            int hi = std::min(lo + grain_, end_);
+            body_(TaskRange(lo, hi));
+        }
+
+    private:
+        int begin_;
+        int end_;
+        int grain_;
+        const RangeBody& body_;
+};
+
+/*
+ * Turns a per-index body into a range body; the loop below is where the
+ * per-index body gets inlined.
+ */
+template <typename IndexBody>
+struct IndexLoop {
+    const IndexBody& body_;
+    explicit IndexLoop(const IndexBody& body) : body_(body) {}
+    void operator()(TaskRange r) const {
+        for (int i = r.begin; i < r.end; i++) {
+            body_(i);
+        }
+    }
+};
+
+/*
+ * Calls body(r) for disjoint subranges r covering [begin, end), each at
+ * most `grain` indices long (grain <= 0 picks one automatically).
+ */
+template <typename RangeBody>
+void parallel_for_range(ITaskSystem* t, int begin, int end, int grain,
+                        const RangeBody& body) {
+    if (end <= begin) return;
+    RangeRunnable<RangeBody> runnable(begin, end,
+                                      parallelForGrain(end - begin, grain), body);
+    t->run(&runnable, runnable.numChunks());
+}
+
+template <typename RangeBody>
+void parallel_for_range(ITaskSystem* t, int begin, int end, const RangeBody& body) {
+    parallel_for_range(t, begin, end, 0, body);
+}
+
+/*
+ * Calls body(i) for every i in [0, num_elements), `grain` indices per task.
+ */
+template <typename IndexBody>
+void parallel_for(ITaskSystem* t, int num_elements, int grain, const IndexBody& body) {
+    IndexLoop<IndexBody> loop(body);
+    parallel_for_range(t, 0, num_elements, grain, loop);
+}
+
+#endif
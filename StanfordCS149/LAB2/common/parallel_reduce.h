@@ -0,0 +1,144 @@
+#ifndef _PARALLEL_REDUCE_H
+#define _PARALLEL_REDUCE_H
+
+#include <atomic>
+#include <vector>
+#include "parallel_for.h"
+
+/*
+ * Reduction and scan templates layered over ITaskSystem, built on the
+ * chunking of parallel_for.h.
+ *
+ *   double s = parallel_reduce(t, 0, n, 0, 0.0,
+ *       [&](TaskRange r, double acc) {
+ *           for (int i = r.begin; i < r.end; i++) acc += x[i];
+ *           return acc;
+ *       },
+ *       [](double a, double b) { return a + b; });
+ *
+ * The range function folds a whole chunk into a local accumulator, so the
+ * inner loop has no atomics and no shared writes. Each task then stores a
+ * single partial into its own cache-line-padded slot, and the partials are
+ * combined pairwise in a tree.
+ */
+
+const int CACHE_LINE_SIZE = 64;
+
+// combine-tree levels with at least this many pairs run as a bulk launch
+const int PARALLEL_COMBINE_MIN_PAIRS = 1024;
+
+// Padded by size rather than alignas: std::allocator ignores over-alignment
+// before C++17, so neighbours are kept a full line apart instead.
+template <typename T>
+struct PaddedPartial {
+    T value;
+    char pad[CACHE_LINE_SIZE - sizeof(T) % CACHE_LINE_SIZE];
+    PaddedPartial(const T& v) : value(v) {}
+};
+
+/*
+ * Combines partials[0..n) pairwise (stride 1, 2, 4, ...) and returns the
+ * total. The combine order depends only on n, never on scheduling.
+ */
+template <typename T, typename Combine>
+T treeCombine(ITaskSystem* t, std::vector<PaddedPartial<T> >& partials,
+              const Combine& combine) {
+    int n = partials.size();
+    for (int stride = 1; stride < n; stride *= 2) {
+        int num_pairs = (n - stride - 1) / (2 * stride) + 1;
+        auto level = [&partials, &combine, stride](int k) {
+            int i = 2 * stride * k;
+            partials[i].value = combine(partials[i].value, partials[i + stride].value);
+        };
+        if (num_pairs >= PARALLEL_COMBINE_MIN_PAIRS) {
+            parallel_for(t, num_pairs, 0, level);
+        } else {
+            for (int k = 0; k < num_pairs; k++) level(k);
+        }
+    }
+    return partials[0].value;
+}
+
+/*
+ * Reduces [begin, end) with range_fn(TaskRange r, T init) -> T, which folds
+ * the indices of r into init, and the associative combine(T, T) -> T.
+ *
+ * deterministic = true: one partial per `grain`-sized chunk, combined in
+ *   chunk order, so the result (floating point included) is identical from
+ *   run to run and across task systems for the same grain.
+ * deterministic = false: one partial per thread of t (numThreads()); the
+ *   worker tasks pull chunks dynamically (one atomic per chunk), which
+ *   balances uneven chunks better but makes the association order depend
+ *   on scheduling.
+ */
+template <typename T, typename RangeFn, typename Combine>
+T parallel_reduce(ITaskSystem* t, int begin, int end, int grain, const T& identity,
+                  const RangeFn& range_fn, const Combine& combine,
+                  bool deterministic = true) {
+    if (end <= begin) return identity;
+    grain = parallelForGrain(end - begin, grain);
+    int num_chunks = (end - begin + grain - 1) / grain;
+
+    if (deterministic) {
+        std::vector<PaddedPartial<T> > partials(num_chunks, PaddedPartial<T>(identity));
+        parallel_for_range(t, begin, end, grain, [&](TaskRange r) {
+            partials[(r.begin - begin) / grain].value = range_fn(r, identity);
+        });
+        return treeCombine(t, partials, combine);
+    }
+
+    int num_partials = std::min(num_chunks, t->numThreads());
+    std::vector<PaddedPartial<T> > partials(num_partials, PaddedPartial<T>(identity));
+    std::atomic<int> next_chunk(0);
+    parallel_for(t, num_partials, 1, [&](int slot) {
+        T acc = identity;
+        int chunk;
+        while ((chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) < num_chunks) {
+            int lo = begin + chunk * grain;
+            acc = range_fn(TaskRange(lo, std::min(lo + grain, end)), acc);
+        }
+        partials[slot].value = acc;
+    });
+    return treeCombine(t, partials, combine);
+}
+
+/*
+ * output[i] = input[0] (+) input[1] (+) ... (+) input[i] for the associative
+ * combine (+). Three phases: per-chunk totals in parallel, an exclusive scan
+ * of the (few) chunk totals on the calling thread, then a parallel pass that
+ * rescans each chunk starting from its offset. input may equal output.
+ */
+template <typename T, typename Combine>
+void parallel_inclusive_scan(ITaskSystem* t, const T* input, T* output,
+                             int num_elements, int grain, const T& identity,
+                             const Combine& combine) {
+    if (num_elements <= 0) return;
+    grain = parallelForGrain(num_elements, grain);
+    int num_chunks = (num_elements + grain - 1) / grain;
+    std::vector<PaddedPartial<T> > offsets(num_chunks, PaddedPartial<T>(identity));
+
+    parallel_for_range(t, 0, num_elements, grain, [&](TaskRange r) {
+        T acc = identity;
+        for (int i = r.begin; i < r.end; i++) {
+            acc = combine(acc, input[i]);
+        }
+        offsets[r.begin / grain].value = acc;
+    });
+
+    T carry = identity;
+    for (int c = 0; c < num_chunks; c++) {
+        T chunk_total = offsets[c].value;
+        offsets[c].value = carry;
+        carry = combine(carry, chunk_total);
+    }
+
+    parallel_for_range(t, 0, num_elements, grain, [&](TaskRange r) {
+        T acc = offsets[r.begin / grain].value;
+        for (int i = r.begin; i < r.end; i++) {
+            acc = combine(acc, input[i]);
+            output[i] = acc;
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+ * Hardware and scheduler counters through perf_event_open, so a timing
+ * regression can be traced to IPC, cache misses or context switches:
+ *
+ *   PerfCounters counters;
+ *   counters.open(0, true);     // this thread and the threads it creates
+ *   counters.start();
+ *   ...run the workload, join its threads...
+ *   counters.stop();
+ *   printPerfCounts("total", counters.read());
+ *
+ * Counters are per thread. With `inherit`, threads created after open()
+ * are counted too, but their counts are only folded in when they exit;
+ * threads that already exist (a persistent pool) are opened one by one
+ * from processThreadIds() instead.
+ *
+ * Any event the kernel refuses (no PMU in a VM, perf_event_paranoid,
+ * seccomp, a non-Linux build) is reported as n/a rather than failing the
+ * run; open() returns false only if no event at all could be opened.
+ */
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_NUM_EVENTS
+};
+
+struct PerfCounts {
+    bool valid[PERF_NUM_EVENTS];
+    double value[PERF_NUM_EVENTS];
+
+    PerfCounts() {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            valid[e] = false;
+            value[e] = 0;
+        }
+    }
+
+    bool anyValid() const {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (valid[e]) return true;
+        }
+        return false;
+    }
+
+    void add(const PerfCounts& other) {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (!other.valid[e]) continue;
+            valid[e] = true;
+            value[e] += other.value[e];
+        }
+    }
+
+    void scale(double factor) {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++)
+            value[e] *= factor;
+    }
+};
+
+class PerfCounters {
+    public:
+        PerfCounters() {}
+        ~PerfCounters() { close(); }
+
+        /*
+          Opens the events on thread `tid` (0 for the calling thread) and
+          adds it to the set read() sums over. Returns false, leaving the
+          reason in unavailableReason(), if none of the events opened.
+         */
+        bool open(int tid, bool inherit) {
+#if defined(__linux__)
+            bool any = false;
+            for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                int fd = openEvent((PerfEvent) e, tid, inherit);
+                fds_.push_back(fd);
+                any = any || fd >= 0;
+            }
+            tids_.push_back(tid);
+            return any;
+#else
+            (void) tid;
+            (void) inherit;
+            unavailableReasonStorage() = "not supported on this platform";
+            return false;
+#endif
+        }
+
+        void close() {
+#if defined(__linux__)
+            for (size_t i = 0; i < fds_.size(); i++) {
+                if (fds_[i] >= 0) ::close(fds_[i]);
+            }
+#endif
+            fds_.clear();
+            tids_.clear();
+        }
+
+        int numThreads() const { return (int) tids_.size(); }
+        int threadId(int i) const { return tids_[i]; }
+
+        void start() {
+#if defined(__linux__)
+            for (size_t i = 0; i < fds_.size(); i++) {
+                if (fds_[i] < 0) continue;
+                ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        void stop() {
+#if defined(__linux__)
+            for (size_t i = 0; i < fds_.size(); i++) {
+                if (fds_[i] >= 0) ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+#endif
+        }
+
+        // Counts of the i-th opened thread.
+        PerfCounts readThread(int i) const {
+            PerfCounts counts;
+#if defined(__linux__)
+            for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                int fd = fds_[i * PERF_NUM_EVENTS + e];
+                // value, time enabled, time running
+                uint64_t data[3];
+                if (fd < 0 || ::read(fd, data, sizeof(data)) != (ssize_t) sizeof(data))
+                    continue;
+                counts.valid[e] = true;
+                // Scale up events the PMU had to multiplex with others
+                if (data[2] > 0 && data[2] < data[1])
+                    counts.value[e] = (double) data[0] * data[1] / data[2];
+                else
+                    counts.value[e] = (double) data[0];
+            }
+#endif
+            return counts;
+        }
+
+        // Counts summed over every opened thread.
+        PerfCounts read() const {
+            PerfCounts counts;
+            for (int i = 0; i < numThreads(); i++)
+                counts.add(readThread(i));
+            return counts;
+        }
+
+        static const char* unavailableReason() {
+            return unavailableReasonStorage().c_str();
+        }
+
+    private:
+        std::vector<int> fds_;   // PERF_NUM_EVENTS per opened thread, -1 if refused
+        std::vector<int> tids_;
+
+        PerfCounters(const PerfCounters&);
+        PerfCounters& operator=(const PerfCounters&);
+
+        static std::string& unavailableReasonStorage() {
+            static std::string reason;
+            return reason;
+        }
+
+#if defined(__linux__)
+        static int openEvent(PerfEvent event, int tid, bool inherit) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.disabled = 1;
+            attr.inherit = inherit ? 1 : 0;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            switch (event) {
+            case PERF_CYCLES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PERF_INSTRUCTIONS:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PERF_CACHE_MISSES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case PERF_LLC_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_LL |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            case PERF_BRANCH_MISSES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            default:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+                break;
+            }
+            int fd = (int) syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+            if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+                // perf_event_paranoid >= 2 only allows user-space counting
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fd = (int) syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+            }
+            if (fd < 0)
+                unavailableReasonStorage() = strerror(errno);
+            return fd;
+        }
+#endif
+};
+
+// Kernel ids of the calling process's threads, the calling thread included.
+inline std::vector<int> processThreadIds() {
+    std::vector<int> tids;
+#if defined(__linux__)
+    DIR* dir = opendir("/proc/self/task");
+    if (dir == NULL) return tids;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            tids.push_back(atoi(entry->d_name));
+    }
+    closedir(dir);
+#endif
+    return tids;
+}
+
+inline int currentThreadId() {
+#if defined(__linux__)
+    return (int) syscall(SYS_gettid);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Whether any event can be counted at all; when not, the reason is in
+ * PerfCounters::unavailableReason().
+ */
+inline bool perfCountersAvailable() {
+    PerfCounters probe;
+    return probe.open(0, false);
+}
+
+/*
+ * Opens every thread the process has right now, the calling thread first,
+ * so readThread(1..) are the workers of an already running pool.
+ */
+inline void openProcessThreads(PerfCounters* counters) {
+    int self = currentThreadId();
+    counters->open(0, false);
+    std::vector<int> tids = processThreadIds();
+    for (size_t i = 0; i < tids.size(); i++) {
+        if (tids[i] != self) counters->open(tids[i], false);
+    }
+}
+
+/*
+ * One line of counts: "<label>: cycles ... instr ... IPC ... cache-miss ...
+ * LLC-miss ... br-miss ... ctx-sw ...", with n/a for refused events.
+ */
+inline void printPerfCounts(const char* label, const PerfCounts& counts) {
+    static const char* names[PERF_NUM_EVENTS] = {
+        "cycles", "instr", "cache-miss", "LLC-miss", "br-miss", "ctx-sw"
+    };
+    printf("    %s:", label);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (!counts.valid[e])
+            printf(" %s n/a", names[e]);
+        else if (e == PERF_CONTEXT_SWITCHES)
+            printf(" %s %.0f", names[e], counts.value[e]);
+        else
+            printf(" %s %.3g", names[e], counts.value[e]);
+        if (e == PERF_INSTRUCTIONS) {
+            if (counts.valid[PERF_CYCLES] && counts.valid[PERF_INSTRUCTIONS] &&
+                counts.value[PERF_CYCLES] > 0)
+                printf(" IPC %.2f", counts.value[PERF_INSTRUCTIONS] / counts.value[PERF_CYCLES]);
+            else
+                printf(" IPC n/a");
+        }
+    }
+    printf("\n");
+}
+
+#endif
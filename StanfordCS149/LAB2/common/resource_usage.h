@@ -0,0 +1,174 @@
+#ifndef _RESOURCE_USAGE_H
+#define _RESOURCE_USAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#endif
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "CycleTimer.h"
+
+/*
+ * What a run cost rather than how long it took: process CPU time from
+ * getrusage() and, where the kernel exposes RAPL through powercap, package
+ * energy. A pool that spins while idle can match a sleeping one in wall
+ * time while burning every core; CPU-seconds per wall-second shows it.
+ *
+ *   ResourceUsage before = ResourceUsage::now();
+ *   ...run the workload, join its threads...
+ *   ResourceUsage used = ResourceUsage::now() - before;
+ *   printResourceUsage(used);
+ *
+ * CPU time covers every thread of the process, live or exited, plus
+ * children once they are reaped. Energy is the whole package, so other
+ * load on the machine is included; it is n/a when there is no RAPL or
+ * energy_uj is not readable (recent kernels restrict it to root).
+ */
+
+// Package energy counters under /sys/class/powercap ("intel-rapl:N",
+// which AMD machines also use).
+class RaplEnergy {
+    public:
+        static RaplEnergy& instance() {
+            static RaplEnergy rapl;
+            return rapl;
+        }
+
+        bool available() const { return !domains_.empty(); }
+
+        // Current counter of each package domain, in microjoules.
+        std::vector<uint64_t> read() const {
+            std::vector<uint64_t> uj;
+            for (size_t i = 0; i < domains_.size(); i++) {
+                uint64_t value = 0;
+                readCounter(domains_[i] + "/energy_uj", &value);
+                uj.push_back(value);
+            }
+            return uj;
+        }
+
+        // Joules between two read()s, allowing each counter to wrap once.
+        double joulesBetween(const std::vector<uint64_t>& before,
+                             const std::vector<uint64_t>& after) const {
+            double joules = 0;
+            for (size_t i = 0; i < domains_.size() && i < before.size() && i < after.size(); i++) {
+                uint64_t delta = after[i] >= before[i]
+                    ? after[i] - before[i]
+                    : max_range_uj_[i] - before[i] + after[i];
+                joules += delta * 1e-6;
+            }
+            return joules;
+        }
+
+    private:
+        std::vector<std::string> domains_;
+        std::vector<uint64_t> max_range_uj_;
+
+        RaplEnergy() {
+#if defined(__linux__)
+            const char* root = "/sys/class/powercap";
+            DIR* dir = opendir(root);
+            if (dir == NULL) return;
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL) {
+                // top-level packages only: "intel-rapl:0", not "intel-rapl:0:1"
+                const char* colon = strchr(entry->d_name, ':');
+                if (strncmp(entry->d_name, "intel-rapl", 10) != 0 || colon == NULL ||
+                    strchr(colon + 1, ':') != NULL)
+                    continue;
+                std::string domain = std::string(root) + "/" + entry->d_name;
+                uint64_t energy, max_range;
+                if (!readCounter(domain + "/energy_uj", &energy) ||
+                    !readCounter(domain + "/max_energy_range_uj", &max_range))
+                    continue;
+                domains_.push_back(domain);
+                max_range_uj_.push_back(max_range);
+            }
+            closedir(dir);
+#endif
+        }
+
+        static bool readCounter(const std::string& path, uint64_t* value) {
+            FILE* f = fopen(path.c_str(), "r");
+            if (f == NULL) return false;
+            unsigned long long v;
+            bool ok = fscanf(f, "%llu", &v) == 1;
+            fclose(f);
+            if (ok) *value = v;
+            return ok;
+        }
+};
+
+inline double timevalSeconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+struct ResourceUsage {
+    double wall_seconds;
+    double cpu_seconds;     // user + system, all threads and reaped children
+    double joules;          // valid only if has_energy
+    bool has_energy;
+    std::vector<uint64_t> energy_uj;
+
+    ResourceUsage() : wall_seconds(0), cpu_seconds(0), joules(0), has_energy(false) {}
+
+    static ResourceUsage now() {
+        ResourceUsage usage;
+        usage.wall_seconds = CycleTimer::currentSeconds();
+        struct rusage self, children;
+        getrusage(RUSAGE_SELF, &self);
+        getrusage(RUSAGE_CHILDREN, &children);
+        usage.cpu_seconds = timevalSeconds(self.ru_utime) + timevalSeconds(self.ru_stime) +
+                            timevalSeconds(children.ru_utime) + timevalSeconds(children.ru_stime);
+        RaplEnergy& rapl = RaplEnergy::instance();
+        usage.has_energy = rapl.available();
+        if (usage.has_energy)
+            usage.energy_uj = rapl.read();
+        return usage;
+    }
+
+    // Usage between two now() samples.
+    ResourceUsage operator-(const ResourceUsage& before) const {
+        ResourceUsage used;
+        used.wall_seconds = wall_seconds - before.wall_seconds;
+        used.cpu_seconds = cpu_seconds - before.cpu_seconds;
+        used.has_energy = has_energy && before.has_energy;
+        if (used.has_energy)
+            used.joules = RaplEnergy::instance().joulesBetween(before.energy_uj, energy_uj);
+        return used;
+    }
+
+    // Adds the usage of another region, for tests timing several.
+    ResourceUsage& operator+=(const ResourceUsage& other) {
+        has_energy = (has_energy || wall_seconds == 0) && other.has_energy;
+        wall_seconds += other.wall_seconds;
+        cpu_seconds += other.cpu_seconds;
+        joules += other.joules;
+        return *this;
+    }
+};
+
+/*
+ * "    usage: wall ... ms cpu ... ms (... cores) energy ... J", with n/a
+ * energy when RAPL is unavailable.
+ */
+inline void printResourceUsage(const ResourceUsage& used) {
+    printf("    usage: wall %.3f ms cpu %.3f ms (%.2f cores)",
+           used.wall_seconds * 1000, used.cpu_seconds * 1000,
+           used.wall_seconds > 0 ? used.cpu_seconds / used.wall_seconds : 0.0);
+    if (used.has_energy)
+        printf(" energy %.3f J (%.1f W)\n", used.joules,
+               used.wall_seconds > 0 ? used.joules / used.wall_seconds : 0.0);
+    else
+        printf(" energy n/a\n");
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _SCHEDULE_LOG_H
+#define _SCHEDULE_LOG_H
+
+#include <stdio.h>
+#include <vector>
+#include "itasksys.h"
+
+/*
+ * Text files of ScheduleEvents (see ITaskSystem::recordSchedule()), one
+ * "worker launch_id task_id" line per claim, so a schedule recorded by one
+ * run can be replayed, diffed or bisected in another:
+ *
+ *   t->recordSchedule(true);
+ *   ...run the workload...
+ *   writeSchedule("slow.sched", t->recordedSchedule());
+ *
+ *   std::vector<ScheduleEvent> schedule;
+ *   if (readSchedule("slow.sched", &schedule)) t->replaySchedule(schedule);
+ *   ...run the same workload...
+ */
+
+inline bool writeSchedule(const char* path, const std::vector<ScheduleEvent>& schedule) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) return false;
+    for (const ScheduleEvent& e : schedule) {
+        fprintf(f, "%d %d %d\n", e.worker, e.launch_id, e.task_id);
+    }
+    return fclose(f) == 0;
+}
+
+inline bool readSchedule(const char* path, std::vector<ScheduleEvent>* schedule) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return false;
+    schedule->clear();
+    ScheduleEvent e;
+    while (fscanf(f, "%d %d %d", &e.worker, &e.launch_id, &e.task_id) == 3) {
+        schedule->push_back(e);
+    }
+    bool ok = feof(f);
+    fclose(f);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef _TASKGRAPH_H
+#define _TASKGRAPH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <vector>
+#include "itasksys.h"
+
+/*
+ * TaskGraph: an immutable DAG of bulk task launches, captured once and
+ * launched any number of times with ITaskSystem::launch().
+ *
+ * Dependencies are stored as precomputed successor arrays (CSR layout)
+ * and indegrees, so a task system replaying the graph never allocates
+ * dependency lists or looks up TaskIDs.
+ *
+ * Build one with TaskGraphRecorder:
+ *
+ *   TaskGraphRecorder rec;
+ *   TaskID a = rec.runAsyncWithDeps(&ra, 64, no_deps);
+ *   TaskID b = rec.runAsyncWithDeps(&rb, 64, {a});
+ *   TaskGraph graph = rec.graph();
+ *   for (...) { t->launch(graph); t->sync(); }
+ */
+class TaskGraph {
+    public:
+        struct Node {
+            IRunnable* runnable;
+            int num_total_tasks;
+            int indegree;
+            int first_successor;   // index into successors()
+            int num_successors;
+        };
+
+        TaskGraph() : id_(nextGraphId()) {}
+
+        int id() const { return id_; }
+        int numNodes() const { return nodes_.size(); }
+        const Node& node(int i) const { return nodes_[i]; }
+        const int* successors(int i) const {
+            return successors_.data() + nodes_[i].first_successor;
+        }
+        // nodes with no dependencies, in capture order
+        const std::vector<int>& roots() const { return roots_; }
+
+        /*
+          Generic replay: issues one runAsyncWithDeps() per node in capture
+          order. Used by task systems without a specialized launch().
+         */
+        void replay(ITaskSystem* t) const {
+            std::vector<TaskID> ids(nodes_.size());
+            std::vector<std::vector<TaskID> > deps(nodes_.size());
+            for (size_t i = 0; i < nodes_.size(); i++) {
+                // successors come later in capture order, so deps[i] is
+                // complete by now
+                ids[i] = t->runAsyncWithDeps(nodes_[i].runnable,
+                                             nodes_[i].num_total_tasks, deps[i]);
+                for (int s = 0; s < nodes_[i].num_successors; s++) {
+                    deps[successors(i)[s]].push_back(ids[i]);
+                }
+            }
+        }
+
+    private:
+        friend class TaskGraphRecorder;
+
+        static int nextGraphId() {
+            static std::atomic<int> next_id(0);
+            return next_id++;
+        }
+
+        int id_;   // distinguishes graphs that reuse the same address
+        std::vector<Node> nodes_;
+        std::vector<int> successors_;
+        std::vector<int> roots_;
+};
+
+/*
+ * TaskGraphRecorder: an ITaskSystem that runs nothing and records each
+ * runAsyncWithDeps() call as a graph node. The returned TaskIDs are node
+ * indices, so existing submission code can be pointed at a recorder
+ * unchanged. run() is not supported since it implies waiting for results.
+ */
+class TaskGraphRecorder: public ITaskSystem {
+    public:
+        TaskGraphRecorder() : ITaskSystem(1) {}
+        ~TaskGraphRecorder() {}
+        const char* name() { return "Task Graph Recorder"; }
+
+        void run(IRunnable* runnable, int num_total_tasks) {
+            assert(!"TaskGraphRecorder cannot record synchronous run() calls");
+        }
+
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps) {
+            TaskID id = runnables_.size();
+            runnables_.push_back(runnable);
+            num_tasks_.push_back(num_total_tasks);
+            deps_.push_back(deps);
+            std::vector<TaskID>& d = deps_.back();
+            std::sort(d.begin(), d.end());
+            d.erase(std::unique(d.begin(), d.end()), d.end());
+            for (TaskID dep : d) {
+                assert(dep >= 0 && dep < id);
+            }
+            return id;
+        }
+
+        void sync() {}
+
+        /*
+          Freezes everything recorded so far into a TaskGraph.
+         */
+        TaskGraph graph() const {
+            TaskGraph g;
+            int n = runnables_.size();
+            g.nodes_.resize(n);
+            for (int i = 0; i < n; i++) {
+                g.nodes_[i].runnable = runnables_[i];
+                g.nodes_[i].num_total_tasks = num_tasks_[i];
+                g.nodes_[i].indegree = deps_[i].size();
+                g.nodes_[i].num_successors = 0;
+                if (deps_[i].empty()) g.roots_.push_back(i);
+                for (TaskID dep : deps_[i]) g.nodes_[dep].num_successors++;
+            }
+            int offset = 0;
+            for (int i = 0; i < n; i++) {
+                g.nodes_[i].first_successor = offset;
+                offset += g.nodes_[i].num_successors;
+            }
+            g.successors_.resize(offset);
+            std::vector<int> fill(n, 0);
+            for (int i = 0; i < n; i++) {
+                for (TaskID dep : deps_[i]) {
+                    g.successors_[g.nodes_[dep].first_successor + fill[dep]++] = i;
+                }
+            }
+            return g;
+        }
+
+    private:
+        std::vector<IRunnable*> runnables_;
+        std::vector<int> num_tasks_;
+        std::vector<std::vector<TaskID> > deps_;
+};
+
+#endif
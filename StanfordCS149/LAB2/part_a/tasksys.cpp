@@ -1,11 +1,53 @@
 #include "tasksys.h"
+#include "taskgraph.h"
 #include "../common/CycleTimer.h"
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
 
 #include <iostream>
 IRunnable::~IRunnable() {}  
-ITaskSystem::ITaskSystem(int num_threads) {}
+ITaskSystem::ITaskSystem(int num_threads) : num_threads_(std::max(num_threads, 1)) {}
 ITaskSystem::~ITaskSystem() {}
+void ITaskSystem::launch(const TaskGraph& graph) { graph.replay(this); }
+TaskID ITaskSystem::runAsyncWithHints(IRunnable* runnable, int num_total_tasks,
+                                      const std::vector<TaskID>& deps, const LaunchHints& hints) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+TaskID ITaskSystem::runAsyncAfter(IRunnable* runnable, int num_total_tasks, TaskID dep) {
+    return runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>(1, dep));
+}
+// Aborts unless idx names a launch submitted before launch i of a batch.
+static void checkBatchDep(int idx, int i) {
+    if (idx < 0 || idx >= i) {
+        fprintf(stderr, "submitBatch: launch %d lists batch dependency %d, "
+                "which is not an earlier launch of the batch\n", i, idx);
+        abort();
+    }
+}
+void ITaskSystem::submitBatch(const LaunchDesc* launches, int num_launches, TaskID* ids) {
+    std::vector<TaskID> batch_ids(num_launches);
+    for (int i = 0; i < num_launches; i++) {
+        std::vector<TaskID> deps = launches[i].deps;
+        for (int idx : launches[i].batch_deps) {
+            checkBatchDep(idx, i);
+            deps.push_back(batch_ids[idx]);
+        }
+        batch_ids[i] = runAsyncWithDeps(launches[i].runnable, launches[i].num_total_tasks, deps);
+        if (ids != NULL) ids[i] = batch_ids[i];
+    }
+}
+ContextID ITaskSystem::createContext(const char* name, int weight) { return 0; }
+void ITaskSystem::dropContexts() {}
+void ITaskSystem::setConcurrency(int num_threads) {}
+int ITaskSystem::numThreads() { return num_threads_; }
+void ITaskSystem::setIdleShrinkTimeout(double seconds) {}
+void ITaskSystem::setStaticScheduling(bool enable) {}
+void ITaskSystem::recordSchedule(bool enable) {}
+std::vector<ScheduleEvent> ITaskSystem::recordedSchedule() { return std::vector<ScheduleEvent>(); }
+void ITaskSystem::replaySchedule(const std::vector<ScheduleEvent>& schedule) {}
+void ITaskSystem::setRandomScheduling(bool enable, unsigned int seed) {}
 /*
  * ================================================================
  * Serial task system implementation
@@ -77,29 +119,32 @@ TaskSystemParallelSpawn::~TaskSystemParallelSpawn()
 void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
 
     constexpr int RATIO_THRESHOLD = 2;
+    std::vector<std::thread> threads;
+    // the calling thread takes the last share itself instead of spawning
+    // a thread for it and only waiting
     if ((num_total_tasks / this->pool_count) < RATIO_THRESHOLD) { // Dynamic assignment
         std::atomic<int> curr_task_id{0};
 
-        for (int i = 0; i < this->pool_count; i++) {
-            this->threads.push_back(std::thread(runThreadDynamic, runnable,num_total_tasks, &curr_task_id));
+        for (int i = 0; i < this->pool_count - 1; i++) {
+            threads.push_back(std::thread(runThreadDynamic, runnable,num_total_tasks, &curr_task_id));
         }
+        runThreadDynamic(runnable, num_total_tasks, &curr_task_id);
     }
     else { // Static assignment
         const int tasks_per_thread = num_total_tasks / this->pool_count;
         const int remaining_tasks = num_total_tasks % this->pool_count;
 
         int first_task = 0;
-        for (int i = 0; i < this->pool_count; i++) {
+        for (int i = 0; i < this->pool_count - 1; i++) {
             const int curr_thread_tasks = tasks_per_thread + (i < remaining_tasks ? 1 : 0);
-            this->threads.push_back(std::thread(runThreadStatic, runnable, first_task, curr_thread_tasks, num_total_tasks));
+            threads.push_back(std::thread(runThreadStatic, runnable, first_task, curr_thread_tasks, num_total_tasks));
             first_task += curr_thread_tasks;
         }
-
+        runThreadStatic(runnable, first_task, num_total_tasks - first_task, num_total_tasks);
     }
-    for (auto& t : this->threads) {
+    for (auto& t : threads) {
         t.join();
     }
-    this->threads.clear();
 }
 
 
@@ -134,7 +179,8 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
 }
 
 TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads),
-    runnable_(nullptr), stop_(false), task_done_(0) {
+    stop_(false), num_active_threads_(0),
+    idle_shrink_timeout_(0) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
@@ -142,27 +188,78 @@ TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int n
     // (requiring changes to tasksys.h).
     //
     threads_.reserve(num_threads);
-    for (int i = 0; i < num_threads; ++i) {
-       threads_.emplace_back([&]() {
-           while (!stop_) {
-            int task_index = -1;
-            {
-                std::lock_guard<std::mutex> lk(lk_);
-                if (!task_queue_.empty()) {
-                    task_index = task_queue_.front();
-                    task_queue_.pop();
-                }
-            }
-            if (task_index != -1) {
-                runnable_->runTask(task_index, num_total_tasks_);
-                ++task_done_;
-            }
-       }});
+    setConcurrency(num_threads);
+}
+
+// workers with worker_id >= num_active_threads_ (see setConcurrency()) and
+// workers that spun without work for longer than idle_shrink_timeout_
+// park on park_cv_ instead of burning their core, until run() queues
+// tasks they are allowed to take
+void TaskSystemParallelThreadPoolSpinning::spin_fn(int worker_id) {
+    auto last_task_time = std::chrono::steady_clock::now();
+    while (!stop_) {
+        double timeout = idle_shrink_timeout_;
+        bool parked = worker_id >= num_active_threads_;
+        if (!parked && timeout > 0) {
+            std::chrono::duration<double> idle = std::chrono::steady_clock::now() - last_task_time;
+            parked = idle.count() > timeout;
+        }
+        if (parked) {
+            std::unique_lock<std::mutex> lk(lk_);
+            park_cv_.wait(lk, [this, worker_id] {
+                return stop_ || (worker_id < num_active_threads_ && !task_queue_.empty());
+            });
+            last_task_time = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        if (runQueuedTask() && timeout > 0) last_task_time = std::chrono::steady_clock::now();
     }
 }
 
+// pops and runs one queued task, of any launch; false if the queue was empty
+bool TaskSystemParallelThreadPoolSpinning::runQueuedTask() {
+    PoolTask task(nullptr, -1);
+    {
+        std::lock_guard<std::mutex> lk(lk_);
+        if (task_queue_.empty()) return false;
+        task = task_queue_.front();
+        task_queue_.pop();
+    }
+    PoolLaunch* launch = task.first;
+    launch->runnable_->runTask(task.second, launch->num_total_tasks_);
+    // the run() caller may return (and free launch) right after this
+    ++launch->tasks_done_;
+    return true;
+}
+
+void TaskSystemParallelThreadPoolSpinning::setConcurrency(int num_threads) {
+    num_threads = std::max(num_threads, 1);
+    for (int i = threads_.size(); i < num_threads; ++i) {
+        threads_.emplace_back(&TaskSystemParallelThreadPoolSpinning::spin_fn, this, i);
+    }
+    {
+        std::lock_guard<std::mutex> lk(lk_);
+        num_active_threads_ = num_threads;
+    }
+    park_cv_.notify_all();
+}
+
+int TaskSystemParallelThreadPoolSpinning::numThreads() {
+    std::lock_guard<std::mutex> lk(lk_);
+    return num_active_threads_;
+}
+
+void TaskSystemParallelThreadPoolSpinning::setIdleShrinkTimeout(double seconds) {
+    idle_shrink_timeout_ = std::max(seconds, 0.0);
+}
+
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
-    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lk(lk_);
+        stop_ = true;
+    }
+    park_cv_.notify_all();
     for (auto& thread : threads_) {
         thread.join();
     }
@@ -175,17 +272,19 @@ void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_tota
     // method in Part A.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
-    num_total_tasks_ = num_total_tasks;
-    runnable_ = runnable;
-    task_done_ = 0;
+    PoolLaunch launch(runnable, num_total_tasks);
     {
         std::lock_guard<std::mutex> lk(lk_);
-        assert(task_queue_.empty());
         for (int i = 0; i < num_total_tasks; ++i) {
-            task_queue_.push(i);
+            task_queue_.push(PoolTask(&launch, i));
         }
     }
-    while (task_done_ != num_total_tasks);
+    park_cv_.notify_all(); // wake workers parked after the idle timeout
+    // help while waiting: a run() called from inside a task holds a pool
+    // thread, and would wait forever if every pool thread did the same
+    while (launch.tasks_done_ != num_total_tasks) {
+        runQueuedTask();
+    }
     //why do we need this while loop? 
     // once this goes out of scope
     // the destructor will be called
@@ -237,23 +336,36 @@ void TaskSystemParallelThreadPoolSleeping::signal_fn() {
     }
 }
 
-void TaskSystemParallelThreadPoolSleeping::wait_fn() {
+void TaskSystemParallelThreadPoolSleeping::wait_fn(int worker_id) {
     while(!stop_) {
         std::unique_lock<std::mutex> lk(*thread_state_->mutex_);
         // ADD PREDICATE TO WAIT:
-        thread_state_->condition_variable_->wait(lk, [this] {
-            return !task_queue_.empty() || stop_;
+        // (waiters beyond num_active_waiters_ stay asleep, see setConcurrency())
+        thread_state_->condition_variable_->wait(lk, [this, worker_id] {
+            return (!task_queue_.empty() && worker_id < num_active_waiters_) || stop_;
         });
         
         if (stop_) break;
         if (task_queue_.empty()) continue;  // Safety check
         
-        auto task_index = task_queue_.front();
+        PoolTask task = task_queue_.front();
         task_queue_.pop();
         lk.unlock();
         
-        runnable_->runTask(task_index, num_total_tasks_);
-        ++task_done_;
+        runTask(task);
+    }
+}
+
+// runs a popped task; the one finishing its launch wakes the run() callers
+void TaskSystemParallelThreadPoolSleeping::runTask(PoolTask task) {
+    PoolLaunch* launch = task.first;
+    launch->runnable_->runTask(task.second, launch->num_total_tasks_);
+    // the run() caller may return (and free launch) right after this
+    if (++launch->tasks_done_ == launch->num_total_tasks_) {
+        // taking the mutex orders the notify after the caller's check of
+        // tasks_done_, so it cannot miss the wakeup
+        std::lock_guard<std::mutex> lk(*thread_state_->mutex_);
+        done_cv_.notify_all();
     }
 }
 
@@ -267,14 +379,36 @@ TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int n
     thread_state_ = new ThreadState(num_threads - 1);
     threads_.reserve(num_threads);
     stop_= false;
+    num_active_waiters_ = num_threads - 1;
     threads_.emplace_back(std::thread(&TaskSystemParallelThreadPoolSleeping::signal_fn,this));
     //std::cout<<"step : signal init"<<std::endl;
     for (int i = 1; i < num_threads; ++i) {
-        threads_.emplace_back(std::thread(&TaskSystemParallelThreadPoolSleeping::wait_fn,this));
+        threads_.emplace_back(std::thread(&TaskSystemParallelThreadPoolSleeping::wait_fn,this,i-1));
         //std::cout<<"step: wait init"<<std::endl;
     }
 }
 
+// threads_[0] is the signal thread, threads_[i] runs wait_fn(i-1): growing
+// starts missing waiters, shrinking leaves the extra ones asleep. The
+// run() caller executes tasks too, so num_threads - 1 waiters suffice.
+void TaskSystemParallelThreadPoolSleeping::setConcurrency(int num_threads) {
+    int num_waiters = std::max(num_threads - 1, 0);
+    for (int i = threads_.size(); i <= num_waiters; ++i) {
+        threads_.emplace_back(std::thread(&TaskSystemParallelThreadPoolSleeping::wait_fn,this,i-1));
+    }
+    {
+        std::lock_guard<std::mutex> lk(*thread_state_->mutex_);
+        num_active_waiters_ = num_waiters;
+    }
+    thread_state_->condition_variable_->notify_all();
+}
+
+// the waiters plus the run() caller
+int TaskSystemParallelThreadPoolSleeping::numThreads() {
+    std::lock_guard<std::mutex> lk(*thread_state_->mutex_);
+    return num_active_waiters_ + 1;
+}
+
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     //
     // TODO: CS149 student implementations may decide to perform cleanup
@@ -299,19 +433,31 @@ void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_tota
     // method in Parts A and B.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
-    num_total_tasks_ = num_total_tasks;
-    runnable_ = runnable;
-    task_done_ = 0;
+    PoolLaunch launch(runnable, num_total_tasks);
     {
         std::lock_guard<std::mutex> lk(*thread_state_->mutex_);
         for (int i = 0; i < num_total_tasks; ++i) {
-            task_queue_.push(i);
+            task_queue_.push(PoolTask(&launch, i));
         }
     }
     thread_state_->start_->store(true, std::memory_order_release);
     thread_state_->condition_variable_->notify_all(); // Notify all threads that there are tasks available
     //gotta give a signal here to not let the threads take away from the queue before it's done appending all tasks
-    while (task_done_ != num_total_tasks){/*if(task_done_ % 64 == 0) std::cout<<"task done: "<<task_done_<<std::endl;*/};
+    // help while tasks are queued, so that run() from inside a task cannot
+    // leave every waiter blocked on tasks that nobody is left to run, then
+    // sleep until the last task of the launch finishes
+    std::unique_lock<std::mutex> lk(*thread_state_->mutex_);
+    while (launch.tasks_done_ != num_total_tasks) {
+        if (task_queue_.empty()) {
+            done_cv_.wait(lk);
+            continue;
+        }
+        PoolTask task = task_queue_.front();
+        task_queue_.pop();
+        lk.unlock();
+        runTask(task);
+        lk.lock();
+    }
 }
 
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
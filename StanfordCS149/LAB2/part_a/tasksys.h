@@ -30,8 +30,7 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         ~TaskSystemParallelSpawn();
         const char* name();
 
-        std::atomic<int> pool_count;
-        std::vector<std::thread> threads; //threads are declared but not defined => don't qualify as thread pool
+        std::atomic<int> pool_count; // threads spawned per run(), local to the call so runs can overlap
         const int RATIO_THRESHOLD = 10;  
         /* if (tasks_in_bulk/num_threads >= ratio) 
         => static execution (heuristic approach , but it works)
@@ -42,6 +41,23 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         void sync();
 };
 
+/*
+ * PoolLaunch: the runnable and completion count of one run() call. Queued
+ * tasks point at their launch, so several threads can call run() on the
+ * same pool at once: their tasks share the queue and each caller waits
+ * for its own count.
+ */
+struct PoolLaunch {
+    IRunnable* runnable_;
+    int num_total_tasks_;
+    std::atomic<int> tasks_done_;
+    PoolLaunch(IRunnable* runnable, int num_total_tasks)
+        : runnable_(runnable), num_total_tasks_(num_total_tasks), tasks_done_(0) {}
+};
+
+// a queued task: (launch, task index)
+typedef std::pair<PoolLaunch*, int> PoolTask;
+
 /*
  * TaskSystemParallelThreadPoolSpinning: This class is the student's
  * implementation of a parallel task execution engine that uses a
@@ -58,14 +74,20 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        void setConcurrency(int num_threads);
+        int numThreads();
+        void setIdleShrinkTimeout(double seconds);
 private:
+    void spin_fn(int worker_id);
+    bool runQueuedTask();
+
     std::vector<std::thread> threads_;
-    int num_total_tasks_;
-    IRunnable *runnable_;
-    std::queue<int> task_queue_;
+    std::queue<PoolTask> task_queue_;
     std::mutex lk_;
     bool stop_;
-    std::atomic<int> task_done_;
+    std::atomic<int> num_active_threads_;      // workers with a lower id take tasks
+    std::atomic<double> idle_shrink_timeout_;  // seconds of spinning before parking, 0 = never
+    std::condition_variable park_cv_;          // parked workers sleep here
 };
 
 
@@ -109,18 +131,20 @@ class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        void setConcurrency(int num_threads);
+        int numThreads();
         void signal_fn() ;
-        void wait_fn() ;
+        void wait_fn(int worker_id) ;
+        void runTask(PoolTask task);
 
     
         std::vector<std::thread> threads_;
-        int num_total_tasks_;
-        IRunnable *runnable_;
-        std::queue<int> task_queue_;
+        std::queue<PoolTask> task_queue_;
         std::mutex lk_;
         bool stop_;
-        std::atomic<int> task_done_;
         ThreadState* thread_state_; // for sleeping threads
+        std::condition_variable done_cv_; // signals run() callers that a launch finished, with thread_state_->mutex_
+        int num_active_waiters_; // waiters with a lower id take tasks, guarded by thread_state_->mutex_
 };
 
 #endif
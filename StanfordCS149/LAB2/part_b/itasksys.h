@@ -3,6 +3,50 @@
 #include <vector>
 
 typedef int TaskID;
+typedef int ContextID;
+
+class TaskGraph;
+
+/*
+ * Optional scheduling hints for ITaskSystem::runAsyncWithHints(). A task
+ * system may ignore any of them; they never change what a launch computes.
+ */
+struct LaunchHints {
+    /*
+      TaskID of one of the launch's dependencies whose task i produced the
+      data that task i of the new launch consumes. Task i is then
+      preferably run on the thread that ran task i of that launch, while
+      the data is still in its caches. -1 for no preference.
+     */
+    TaskID affinity_with;
+
+    /*
+      TaskID of a dependency with the same num_total_tasks such that task
+      i of the new launch only reads what task i of that launch wrote.
+      The new launch may then start task i as soon as that task is done,
+      instead of waiting for the whole launch. -1 if not element-wise.
+     */
+    TaskID elementwise_after;
+
+    /*
+      Submission context the launch is charged to (see
+      ITaskSystem::createContext()). 0 is the default context.
+     */
+    ContextID context;
+
+    LaunchHints() : affinity_with(-1), elementwise_after(-1), context(0) {}
+};
+
+/*
+ * One scheduling decision of a task system: thread `worker` claimed task
+ * `task_id` of launch `launch_id`. Threads outside the pool (callers of
+ * run() and sync()) are worker -1. See ITaskSystem::recordSchedule().
+ */
+struct ScheduleEvent {
+    int worker;
+    TaskID launch_id;
+    int task_id;
+};
 
 class IRunnable {
     public:
@@ -20,6 +64,22 @@ class IRunnable {
         virtual void runTask(int task_id, int num_total_tasks) = 0;
 };
 
+/*
+ * One bulk task launch of ITaskSystem::submitBatch(). A launch depends on
+ * the launches in `deps` (TaskIDs of earlier submissions) and on the
+ * launches of the same batch at the indices in `batch_deps`, which must
+ * all be lower than its own index.
+ */
+struct LaunchDesc {
+    IRunnable* runnable;
+    int num_total_tasks;
+    std::vector<TaskID> deps;
+    std::vector<int> batch_deps;
+
+    LaunchDesc() : runnable(nullptr), num_total_tasks(0) {}
+    LaunchDesc(IRunnable* r, int n) : runnable(r), num_total_tasks(n) {}
+};
+
 class ITaskSystem {
     public:
         /*
@@ -61,10 +121,132 @@ class ITaskSystem {
         virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                         const std::vector<TaskID>& deps) = 0;
 
+        /*
+          Same as runAsyncWithDeps(), plus scheduling hints (see
+          LaunchHints). The default implementation ignores the hints.
+         */
+        virtual TaskID runAsyncWithHints(IRunnable* runnable, int num_total_tasks,
+                                         const std::vector<TaskID>& deps,
+                                         const LaunchHints& hints);
+
+        /*
+          Same as runAsyncWithDeps() with the single dependency `dep`, but
+          without building a dependency vector. Intended for chains of
+          launches (see LaunchFuture::then() in launch_future.h).
+         */
+        virtual TaskID runAsyncAfter(IRunnable* runnable, int num_total_tasks,
+                                     TaskID dep);
+
+        /*
+          Submits the num_launches launches of `launches` as if by one
+          runAsyncWithDeps() call each, in order, and stores their TaskIDs
+          in `ids` (unless it is NULL). Task systems can take their
+          scheduler lock and wake their workers once for the whole batch
+          instead of once per launch.
+         */
+        virtual void submitBatch(const LaunchDesc* launches, int num_launches, TaskID* ids);
+
+        /*
+          Creates a named submission context, e.g. one per subsystem
+          sharing the task system. Launches are assigned to a context
+          through LaunchHints::context; when several contexts have ready
+          tasks, each gets a share of the threads proportional to its
+          `weight` (>= 1), so a small launch in one context is not queued
+          behind a huge launch in another. Everything submitted without
+          hints runs in the default context 0, of weight 1.
+
+          The default implementation returns 0: all launches share one
+          context.
+         */
+        virtual ContextID createContext(const char* name, int weight);
+
+        /*
+          Drops every context created by createContext(), so a long-lived
+          task system shared by successive tenants does not accumulate
+          them. Their ContextIDs become invalid and are not handed out
+          again; launches hinted with an invalid context run in the
+          default context. Must be called with no launch outstanding,
+          e.g. right after sync(). The default implementation does
+          nothing.
+         */
+        virtual void dropContexts();
+
+        /*
+          Changes the number of threads the task system may use to
+          num_threads (>= 1) without recreating it. Tasks already running
+          finish normally; extra threads are started or parked as needed.
+          The default implementation ignores the request.
+         */
+        virtual void setConcurrency(int num_threads);
+
+        /*
+          Number of threads the task system runs tasks on: the
+          constructor's num_threads, or the last setConcurrency(). Helpers
+          such as parallel_reduce() size per-thread state with it. The
+          default implementation returns the constructor's num_threads.
+         */
+        virtual int numThreads();
+
+        /*
+          Lets worker threads that have found no work for `seconds` give
+          their core back (exit or park); they come back when new work is
+          launched. 0, the default, keeps idle workers around. The default
+          implementation ignores the request.
+         */
+        virtual void setIdleShrinkTimeout(double seconds);
+
+        /*
+          Static scheduling, like OpenMP's schedule(static) on persistent
+          threads: while enabled, the tasks of every launch that becomes
+          ready are split into one contiguous range per worker, plus one
+          for the thread waiting in run() or sync(), and the same task
+          range of a launch with the same number of tasks goes to the same
+          worker every time, so data a worker touched in one launch is
+          still in its cache in the next. A worker that runs out of its
+          own tasks steals from workers that are behind. The default
+          implementation ignores the request.
+         */
+        virtual void setStaticScheduling(bool enable);
+
+        /*
+          Debugging aids for scheduling-dependent behavior. All default
+          implementations do nothing (recordedSchedule() returns nothing).
+
+           - recordSchedule(true): from now on, log every task claim in
+             the order claims happen; recordedSchedule() returns the log.
+           - replaySchedule(schedule): make the following claims happen
+             exactly as in `schedule` (same worker, same order). Requires
+             the same program and thread count as the recording; if the
+             program diverges, the task system reports it and goes back
+             to normal scheduling.
+           - setRandomScheduling(true, seed): pick among all available
+             work at random, from a generator seeded with `seed`, to
+             stress-test for ordering assumptions.
+         */
+        virtual void recordSchedule(bool enable);
+        virtual std::vector<ScheduleEvent> recordedSchedule();
+        virtual void replaySchedule(const std::vector<ScheduleEvent>& schedule);
+        virtual void setRandomScheduling(bool enable, unsigned int seed);
+
         /*
           Blocks until all tasks created as a result of **any prior**
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Asynchronously launches every bulk task launch captured in
+          `graph` (see taskgraph.h), honoring the graph's dependencies, as
+          if each node had been passed to runAsyncWithDeps() in capture
+          order. The same graph may be launched repeatedly; the caller
+          must invoke sync() to guarantee completion.
+
+          The default implementation does exactly that; task systems can
+          override it to reuse the graph's precomputed dependency arrays.
+         */
+        virtual void launch(const TaskGraph& graph);
+
+    private:
+        int num_threads_;
 };
 #endif
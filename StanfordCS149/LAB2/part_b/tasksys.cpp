@@ -1,10 +1,51 @@
 #include "tasksys.h"
+#include "CycleTimer.h"
+#include <cstdio>
+#include <cstdlib>
 
 
 IRunnable::~IRunnable() {}
 
-ITaskSystem::ITaskSystem(int num_threads) {}
+ITaskSystem::ITaskSystem(int num_threads) : num_threads_(std::max(num_threads, 1)) {}
 ITaskSystem::~ITaskSystem() {}
+void ITaskSystem::launch(const TaskGraph& graph) { graph.replay(this); }
+TaskID ITaskSystem::runAsyncWithHints(IRunnable* runnable, int num_total_tasks,
+                                      const std::vector<TaskID>& deps, const LaunchHints& hints) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+TaskID ITaskSystem::runAsyncAfter(IRunnable* runnable, int num_total_tasks, TaskID dep) {
+    return runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>(1, dep));
+}
+// Aborts unless idx names a launch submitted before launch i of a batch.
+static void checkBatchDep(int idx, int i) {
+    if (idx < 0 || idx >= i) {
+        fprintf(stderr, "submitBatch: launch %d lists batch dependency %d, "
+                "which is not an earlier launch of the batch\n", i, idx);
+        abort();
+    }
+}
+void ITaskSystem::submitBatch(const LaunchDesc* launches, int num_launches, TaskID* ids) {
+    std::vector<TaskID> batch_ids(num_launches);
+    for (int i = 0; i < num_launches; i++) {
+        std::vector<TaskID> deps = launches[i].deps;
+        for (int idx : launches[i].batch_deps) {
+            checkBatchDep(idx, i);
+            deps.push_back(batch_ids[idx]);
+        }
+        batch_ids[i] = runAsyncWithDeps(launches[i].runnable, launches[i].num_total_tasks, deps);
+        if (ids != NULL) ids[i] = batch_ids[i];
+    }
+}
+ContextID ITaskSystem::createContext(const char* name, int weight) { return 0; }
+void ITaskSystem::dropContexts() {}
+void ITaskSystem::setConcurrency(int num_threads) {}
+int ITaskSystem::numThreads() { return num_threads_; }
+void ITaskSystem::setIdleShrinkTimeout(double seconds) {}
+void ITaskSystem::setStaticScheduling(bool enable) {}
+void ITaskSystem::recordSchedule(bool enable) {}
+std::vector<ScheduleEvent> ITaskSystem::recordedSchedule() { return std::vector<ScheduleEvent>(); }
+void ITaskSystem::replaySchedule(const std::vector<ScheduleEvent>& schedule) {}
+void ITaskSystem::setRandomScheduling(bool enable, unsigned int seed) {}
 
 /*
  * ================================================================
@@ -122,62 +163,953 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
  * ================================================================
  */
 
+// Every bulk launch gets its own BulkLaunch record, so launches never
+// share runnable/num_total_tasks state and can overlap freely. A launch
+// sits in the ready queue of its submission context once all of its
+// dependencies are done and until its last task has been handed out.
+// Task hand-out and completion are both done under mutex_, which keeps
+// the dependency bookkeeping simple.
+//
+// Threads waiting in run() or sync() do not just block: they keep
+// pulling ready tasks (help-first), so a runTask() that calls run() on
+// a nested launch makes progress even when every pool thread is busy.
+//
+// A launch declared element-wise after its only pending dependency is
+// fused onto it: task i runs as soon as task i of the dependency is done.
+//
+// Contexts with ready launches take turns in deficit round-robin order
+// (active_contexts_): on its turn a context may claim up to weight_ *
+// DRR_QUANTUM_TASKS tasks from its oldest ready launch before the next
+// context's turn comes. A 4-task launch in one context thus waits for at
+// most one quantum of every other active context, however many tasks
+// those still have queued.
+//
+// Launches submitted with an affinity hint bypass the ready queues: when
+// they become ready, task i is queued on the worker that ran task i of the
+// hinted predecessor (worker_queues_). Workers drain their own queue first
+// and only steal from other queues when they have nothing else to do.
+//
+// setConcurrency() changes how many workers may claim tasks
+// (num_active_workers_): workers beyond that count stay parked on
+// work_cv_, and their queued tasks get stolen by the active ones. With an
+// idle-shrink timeout set, a worker that waits that long for work exits;
+// makeReady() restarts retired workers when work shows up again.
+//
+// In static scheduling mode, the tasks of a launch are split into one
+// contiguous range per active worker plus a last one for the thread
+// waiting in run() or sync(). Each worker's range is cut into chunk_size_
+// pieces on its queue; the last range stays on the launch, which goes
+// through the ready queue as usual, so the waiting thread helps instead of
+// idling a core. The ranges depend only on the number of tasks and active
+// workers, so repeated launches map tasks to workers identically; workers
+// only deviate from the plan once their own queue is empty, by helping
+// with the last range or stealing the last pieces of the worker that is
+// furthest behind.
+//
+// Each claim is timed with CycleTimer::currentTicks() and folded into the
+// TaskCost of the runnable's type (task_costs_). A launch of a type with a
+// known cost is handed out in chunks of about TARGET_CHUNK_SECONDS of work,
+// but never so large that a thread would get fewer than
+// MIN_CHUNKS_PER_THREAD of them; run() executes a launch predicted to be
+// shorter than INLINE_LAUNCH_SECONDS on the calling thread without
+// touching the queues.
+//
+// For debugging, every claim can be logged as a ScheduleEvent. While a
+// logged schedule is replayed, claimTask() only lets the thread named by
+// the next event claim, and only that event's task; the other threads
+// sleep, and every replayed claim wakes them to check whose turn it is.
+
+// pool and index of the worker thread executing this code, if any
+static thread_local const TaskSystemParallelThreadPoolSleeping* tls_pool = nullptr;
+static thread_local int tls_worker_id = -1;
+
 const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
-    //
-    // TODO: CS149 student implementations may decide to perform setup
-    // operations (such as thread pool construction) here.
-    // Implementations are free to add new class member variables
-    // (requiring changes to tasksys.h).
-    //
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads),
+    num_dropped_contexts_(0), num_ready_launches_(0), num_replays_in_flight_(0), num_queued_tasks_(0), next_id_(0),
+    num_sleeping_waiters_(0), num_active_workers_(0), num_retired_workers_(0),
+    idle_shrink_timeout_(0), static_scheduling_(false), recording_(false), replay_pos_(0), random_scheduling_(false),
+    num_running_tasks_(0), target_chunk_ticks_(TARGET_CHUNK_SECONDS * CycleTimer::ticksPerSecond()),
+    inline_launch_ticks_(INLINE_LAUNCH_SECONDS * CycleTimer::ticksPerSecond()), stop_(false) {
+    contexts_.push_back(SubmissionContext("default", 1));
+    std::lock_guard<std::mutex> lk(mutex_);
+    resizeWorkers(num_threads);
 }
 
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
-    //
-    // TODO: CS149 student implementations may decide to perform cleanup
-    // operations (such as thread pool shutdown construction) here.
-    // Implementations are free to add new class member variables
-    // (requiring changes to tasksys.h).
-    //
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    // launches that were never synced
+    for (auto& entry : in_flight_) {
+        if (!entry.second->waited_) delete entry.second;
+    }
+    for (GraphReplay* replay : graph_replays_) {
+        delete replay;
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::workerLoop(int worker_id) {
+    tls_pool = this;
+    tls_worker_id = worker_id;
+    std::unique_lock<std::mutex> lk(mutex_);
+    auto has_work = [this, worker_id] {
+        if (stop_) return true;
+        if (worker_id >= num_active_workers_) return false;
+        if (replaying()) return replayTurn(worker_id);
+        return num_ready_launches_ > 0 || num_queued_tasks_ > 0;
+    };
+    bool idle = false;
+    std::chrono::steady_clock::time_point idle_since;
+    while (true) {
+        if (has_work()) {
+            if (stop_) break;
+            idle = false;
+            runOneTask(lk, nullptr);
+            continue;
+        }
+        if (!idle) {
+            idle = true;
+            idle_since = std::chrono::steady_clock::now();
+        }
+        // idle_shrink_timeout_ is re-read on every wakeup, so a timeout
+        // changed by setIdleShrinkTimeout() applies to this idle period
+        if (idle_shrink_timeout_ <= 0) {
+            work_cv_.wait(lk);
+            continue;
+        }
+        std::chrono::steady_clock::time_point deadline = idle_since +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(idle_shrink_timeout_));
+        if (std::chrono::steady_clock::now() >= deadline) {
+            retired_[worker_id] = true;
+            ++num_retired_workers_;
+            return;
+        }
+        work_cv_.wait_until(lk, deadline);
+    }
+}
+
+// Makes num_threads - 1 workers active (the thread calling run()/sync()
+// is the last of the num_threads), starting threads that do not exist
+// yet or have retired. Must be called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::resizeWorkers(int num_threads) {
+    int num_workers = std::max(num_threads - 1, 0);
+    if ((int) threads_.size() < num_workers) {
+        worker_queues_.resize(num_workers);
+        retired_.resize(num_workers, false);
+        for (int i = threads_.size(); i < num_workers; ++i) {
+            threads_.emplace_back(&TaskSystemParallelThreadPoolSleeping::workerLoop, this, i);
+        }
+    }
+    num_active_workers_ = num_workers;
+    restartRetiredWorkers();
+}
+
+// Restarts the active workers that exited after the idle-shrink timeout.
+// A retired worker released mutex_ for the last time before setting its
+// flag, so joining it here cannot deadlock. Must be called with mutex_
+// held.
+void TaskSystemParallelThreadPoolSleeping::restartRetiredWorkers() {
+    for (int i = 0; i < num_active_workers_ && num_retired_workers_ > 0; ++i) {
+        if (!retired_[i]) continue;
+        threads_[i].join();
+        threads_[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::workerLoop, this, i);
+        retired_[i] = false;
+        --num_retired_workers_;
+    }
+}
+
+int TaskSystemParallelThreadPoolSleeping::currentWorkerId() const {
+    return tls_pool == this ? tls_worker_id : -1;
+}
+
+TaskCost* TaskSystemParallelThreadPoolSleeping::costOf(BulkLaunch* launch) {
+    if (launch->cost_ == nullptr) {
+        launch->cost_ = &task_costs_[std::type_index(typeid(*launch->runnable_))];
+    }
+    return launch->cost_;
+}
+
+// Tasks per claim for a launch that is becoming ready: 1 until its
+// runnable type has been timed. Must be called with mutex_ held.
+int TaskSystemParallelThreadPoolSleeping::chunkSize(BulkLaunch* launch) {
+    TaskCost* cost = costOf(launch);
+    if (cost->num_samples_ == 0 || singleTaskClaims()) return 1;
+    int num_threads = num_active_workers_ + 1;
+    int max_chunk = launch->num_total_tasks_ / (MIN_CHUNKS_PER_THREAD * num_threads);
+    double chunk = target_chunk_ticks_ / std::max(cost->ticks_per_task_, 1.0);
+    return std::max(1, std::min(max_chunk, (int) std::min(chunk, 1e9)));
+}
+
+// Recorded, replayed and randomized schedules are made of single tasks.
+bool TaskSystemParallelThreadPoolSleeping::singleTaskClaims() const {
+    return recording_ || random_scheduling_ || replaying();
+}
+
+// Hands out the next num_tasks unclaimed tasks of a ready launch and
+// returns the first one's index. A context whose last ready launch is
+// drained leaves the round-robin and forfeits the rest of its quantum.
+int TaskSystemParallelThreadPoolSleeping::takeTasks(BulkLaunch* launch, int num_tasks) {
+    int task_id = launch->next_task_;
+    launch->next_task_ += num_tasks;
+    if (launch->next_task_ == launch->num_total_tasks_) {
+        SubmissionContext& ctx = contexts_[launch->context_];
+        if (launch == ctx.ready_.front()) {
+            ctx.ready_.pop_front();
+        } else {
+            ctx.ready_.erase(std::find(ctx.ready_.begin(), ctx.ready_.end(), launch));
+        }
+        --num_ready_launches_;
+        if (ctx.ready_.empty()) {
+            ctx.active_ = false;
+            ctx.deficit_ = 0;
+            bool had_turn = (active_contexts_.front() == launch->context_);
+            active_contexts_.erase(std::find(active_contexts_.begin(), active_contexts_.end(),
+                                             launch->context_));
+            if (had_turn && !active_contexts_.empty()) startTurn();
+        }
+    }
+    return task_id;
+}
+
+// Grants the context at the front of active_contexts_ its quantum.
+void TaskSystemParallelThreadPoolSleeping::startTurn() {
+    SubmissionContext& ctx = contexts_[active_contexts_.front()];
+    ctx.deficit_ += ctx.weight_ * DRR_QUANTUM_TASKS;
+}
+
+// Deficit round-robin: returns the oldest ready launch of the context
+// whose turn it is, moving on to the next context once the current one
+// has used up its quantum. Requires num_ready_launches_ > 0.
+BulkLaunch* TaskSystemParallelThreadPoolSleeping::nextReadyLaunch() {
+    while (contexts_[active_contexts_.front()].deficit_ <= 0) {
+        active_contexts_.push_back(active_contexts_.front());
+        active_contexts_.pop_front();
+        startTurn();
+    }
+    return contexts_[active_contexts_.front()].ready_.front();
+}
+
+// Picks the next tasks for the calling thread: `preferred` first (the
+// launch a run() caller waits on), then the worker's own queue, then a
+// ready launch picked by deficit round-robin, and finally a task stolen
+// from the back of the longest worker queue. Threads outside the pool only
+// steal queued tasks when no worker is active. Claims from ready launches
+// take up to chunk_size_ consecutive tasks; *num_tasks is set to the
+// number claimed, starting at *task_id.
+bool TaskSystemParallelThreadPoolSleeping::claimTask(BulkLaunch* preferred, int worker_id,
+                                                     BulkLaunch** launch, int* task_id,
+                                                     int* num_tasks) {
+    *num_tasks = 1;
+    if (replaying()) {
+        return claimReplayedTask(worker_id, launch, task_id);
+    }
+    if (random_scheduling_) {
+        return claimRandomTask(launch, task_id, num_tasks);
+    }
+    if (preferred != nullptr && preferred->num_pending_deps_ == 0 &&
+        preferred->next_task_ < preferred->num_total_tasks_) {
+        *launch = preferred;
+        *num_tasks = std::min(preferred->chunk_size_,
+                              preferred->num_total_tasks_ - preferred->next_task_);
+        *task_id = takeTasks(preferred, *num_tasks);
+        return true;
+    }
+    if (worker_id >= 0 && !worker_queues_[worker_id].empty()) {
+        QueuedTask task = worker_queues_[worker_id].front();
+        worker_queues_[worker_id].pop_front();
+        --num_queued_tasks_;
+        *launch = task.launch_;
+        *task_id = task.task_id_;
+        *num_tasks = task.num_tasks_;
+        return true;
+    }
+    if (num_ready_launches_ > 0) {
+        *launch = nextReadyLaunch();
+        *num_tasks = std::min((*launch)->chunk_size_,
+                              (*launch)->num_total_tasks_ - (*launch)->next_task_);
+        contexts_[(*launch)->context_].deficit_ -= *num_tasks;
+        *task_id = takeTasks(*launch, *num_tasks);
+        return true;
+    }
+    if ((worker_id >= 0 || num_active_workers_ == 0) && num_queued_tasks_ > 0) {
+        // rob the worker furthest behind
+        std::deque<QueuedTask>* victim = nullptr;
+        for (std::deque<QueuedTask>& queue : worker_queues_) {
+            if (victim == nullptr || queue.size() > victim->size()) victim = &queue;
+        }
+        QueuedTask task = victim->back();
+        victim->pop_back();
+        --num_queued_tasks_;
+        *launch = task.launch_;
+        *task_id = task.task_id_;
+        *num_tasks = task.num_tasks_;
+        return true;
+    }
+    return false;
+}
+
+bool TaskSystemParallelThreadPoolSleeping::replaying() const {
+    return replay_pos_ < replay_.size();
+}
+
+// True if the next replayed claim belongs to `worker_id` and its launch
+// can start.
+bool TaskSystemParallelThreadPoolSleeping::replayTurn(int worker_id) const {
+    const ScheduleEvent& next = replay_[replay_pos_];
+    if (next.worker != worker_id) return false;
+    auto it = in_flight_.find(next.launch_id);
+    if (it == in_flight_.end()) {
+        // an ID already handed out means the replay diverged: let the
+        // thread find out in claimReplayedTask()
+        return next.launch_id < next_id_;
+    }
+    return it->second->num_pending_deps_ == 0;
+}
+
+// Claims the task of the next replayed event if it is the calling
+// thread's turn and the task is available. Must be called with mutex_
+// held.
+bool TaskSystemParallelThreadPoolSleeping::claimReplayedTask(int worker_id, BulkLaunch** launch,
+                                                             int* task_id) {
+    const ScheduleEvent& next = replay_[replay_pos_];
+    if (next.worker != worker_id) return false;
+    auto it = in_flight_.find(next.launch_id);
+    if (it == in_flight_.end()) {
+        // not submitted yet, or already finished without this claim
+        if (next.launch_id < next_id_) stopReplay("launch is not in flight");
+        return false;
+    }
+    BulkLaunch* target = it->second;
+    if (target->num_pending_deps_ > 0) return false;
+
+    bool claimed = false;
+    if (next.task_id == target->next_task_ && target->next_task_ < target->num_total_tasks_) {
+        takeTasks(target, 1);
+        claimed = true;
+    } else {
+        // affinity launches hand their tasks out through worker_queues_
+        for (std::deque<QueuedTask>& queue : worker_queues_) {
+            for (auto q = queue.begin(); q != queue.end(); ++q) {
+                if (q->launch_ == target && q->task_id_ == next.task_id) {
+                    queue.erase(q);
+                    --num_queued_tasks_;
+                    claimed = true;
+                    break;
+                }
+            }
+            if (claimed) break;
+        }
+    }
+    if (!claimed) {
+        stopReplay("task is not available");
+        return false;
+    }
+
+    *launch = target;
+    *task_id = next.task_id;
+    if (++replay_pos_ == replay_.size()) {
+        replay_.clear();
+        replay_pos_ = 0;
+    }
+    // it may be some other thread's turn now
+    work_cv_.notify_all();
+    if (num_sleeping_waiters_ > 0) {
+        done_cv_.notify_all();
+    }
+    return true;
+}
+
+// Called when no task is running: if the next replayed claim cannot
+// happen before some other task runs, the replay can never continue.
+// Must be called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::checkReplayStalled() {
+    const ScheduleEvent& next = replay_[replay_pos_];
+    auto it = in_flight_.find(next.launch_id);
+    if (next.worker >= num_active_workers_) {
+        stopReplay("worker is not active");
+    } else if (it != in_flight_.end() && it->second->num_pending_deps_ > 0) {
+        stopReplay("launch waits on unfinished dependencies");
+    }
+}
+
+// Gives up on a replay that no longer matches the program. Must be called
+// with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::stopReplay(const char* reason) {
+    const ScheduleEvent& next = replay_[replay_pos_];
+    fprintf(stderr, "Schedule replay diverged at event %zu (worker %d, launch %d, task %d): %s\n",
+            replay_pos_, next.worker, next.launch_id, next.task_id, reason);
+    replay_.clear();
+    replay_pos_ = 0;
+    work_cv_.notify_all();
+    done_cv_.notify_all();
+}
+
+// Picks uniformly among every ready launch and every non-empty worker
+// queue, using rng_. Must be called with mutex_ held.
+bool TaskSystemParallelThreadPoolSleeping::claimRandomTask(BulkLaunch** launch, int* task_id,
+                                                           int* num_tasks) {
+    int num_queues = (num_queued_tasks_ > 0) ? worker_queues_.size() : 0;
+    int num_candidates = num_ready_launches_ + num_queues;
+    if (num_candidates == 0) return false;
+    int pick = std::uniform_int_distribution<int>(0, num_candidates - 1)(rng_);
+
+    if (pick < num_ready_launches_) {
+        for (ContextID c : active_contexts_) {
+            std::deque<BulkLaunch*>& ready = contexts_[c].ready_;
+            if (pick < (int) ready.size()) {
+                *launch = ready[pick];
+                *task_id = takeTasks(*launch, 1);
+                return true;
+            }
+            pick -= ready.size();
+        }
+    }
+    pick -= num_ready_launches_;
+    for (int i = 0; i < num_queues; i++) {
+        std::deque<QueuedTask>& queue = worker_queues_[(pick + i) % num_queues];
+        if (queue.empty()) continue;
+        *launch = queue.front().launch_;
+        *task_id = queue.front().task_id_;
+        *num_tasks = queue.front().num_tasks_;
+        queue.pop_front();
+        --num_queued_tasks_;
+        return true;
+    }
+    return false;
+}
+
+// Claims a chunk of tasks (see claimTask()), runs it with mutex_ released
+// and records its completion and duration. Returns false if there was
+// nothing to run. Must be called with lk held; returns with lk held.
+bool TaskSystemParallelThreadPoolSleeping::runOneTask(std::unique_lock<std::mutex>& lk,
+                                                      BulkLaunch* preferred) {
+    int worker_id = currentWorkerId();
+    BulkLaunch* launch;
+    int task_id;
+    int num_tasks;
+    if (!claimTask(preferred, worker_id, &launch, &task_id, &num_tasks)) {
+        return false;
+    }
+    if (recording_) {
+        ScheduleEvent event = {worker_id, launch->id_, task_id};
+        recorded_.push_back(event);
+    }
+    ++num_running_tasks_;
+
+    // task i of a fused successor runs right after task i of its
+    // predecessor, on the same thread, while the data is still hot
+    int end_task = task_id + num_tasks;
+    while (launch != nullptr) {
+        if (!launch->placement_.empty()) {
+            std::fill(launch->placement_.begin() + task_id,
+                      launch->placement_.begin() + end_task, worker_id);
+        }
+
+        lk.unlock();
+        CycleTimer::SysClock start = CycleTimer::currentTicks();
+        for (int i = task_id; i < end_task; i++) {
+            launch->runnable_->runTask(i, launch->num_total_tasks_);
+        }
+        CycleTimer::SysClock end = CycleTimer::currentTicks();
+        lk.lock();
+
+        // a thread that migrated between cores may see the counter go back
+        if (end > start) {
+            costOf(launch)->addSample((double) (end - start) / num_tasks);
+        }
+        BulkLaunch* fused = launch->fused_successor_;
+        finishTasks(launch, num_tasks);
+        launch = fused;
+    }
+    if (--num_running_tasks_ == 0 && replaying()) {
+        checkReplayStalled();
+    }
+    return true;
+}
+
+void TaskSystemParallelThreadPoolSleeping::finishTasks(BulkLaunch* launch, int num_tasks) {
+    launch->tasks_done_ += num_tasks;
+    if (launch->tasks_done_ == launch->num_total_tasks_) {
+        finishLaunch(launch);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::finishLaunch(BulkLaunch* launch) {
+    launch->done_ = true;
+    GraphReplay* replay = launch->replay_;
+    if (replay == nullptr) {
+        in_flight_.erase(launch->id_);
+    }
+    if (launch->first_successor_ != nullptr) {
+        releaseSuccessor(launch, launch->first_successor_);
+    }
+    for (BulkLaunch* successor : launch->successors_) {
+        releaseSuccessor(launch, successor);
+    }
+    for (int i = 0; i < launch->num_graph_successors_; i++) {
+        releaseSuccessor(launch, launch->graph_successors_[i]);
+    }
+    if (replay != nullptr && --replay->nodes_remaining_ == 0) {
+        replay->busy_ = false;
+        --num_replays_in_flight_;
+    }
+    if (launch->waited_ || idle()) {
+        done_cv_.notify_all();
+    }
+    if (!launch->waited_ && replay == nullptr) {
+        delete launch;
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::releaseSuccessor(BulkLaunch* launch,
+                                                            BulkLaunch* successor) {
+    if (successor->affinity_source_ == launch) {
+        // `launch` is about to be freed: keep where its tasks ran
+        successor->preferred_workers_ = launch->placement_;
+        successor->affinity_source_ = nullptr;
+    }
+    if (--successor->num_pending_deps_ == 0) {
+        makeReady(successor);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::makeReady(BulkLaunch* launch) {
+    if (enqueueReady(launch)) {
+        wakeThreads();
+    }
+}
+
+// Puts a launch whose dependencies are all done where threads look for
+// tasks, without waking anybody. Returns false if the launch had no tasks
+// and finished right away. Must be called with mutex_ held.
+bool TaskSystemParallelThreadPoolSleeping::enqueueReady(BulkLaunch* launch) {
+    if (launch->num_total_tasks_ == 0) {
+        finishLaunch(launch);
+        return false;
+    }
+    if (num_retired_workers_ > 0) {
+        restartRetiredWorkers();
+    }
+    launch->chunk_size_ = chunkSize(launch);
+    if (!launch->preferred_workers_.empty() && num_active_workers_ > 0) {
+        queueOnPreferredWorkers(launch);
+    } else {
+        if (static_scheduling_ && num_active_workers_ > 0) {
+            queueStatically(launch);
+        }
+        if (launch->next_task_ == launch->num_total_tasks_) return true;
+        SubmissionContext& ctx = contexts_[launch->context_];
+        ctx.ready_.push_back(launch);
+        ++num_ready_launches_;
+        if (!ctx.active_) {
+            ctx.active_ = true;
+            active_contexts_.push_back(launch->context_);
+            if (active_contexts_.size() == 1) startTurn();
+        }
+    }
+    return true;
+}
+
+void TaskSystemParallelThreadPoolSleeping::wakeThreads() {
+    work_cv_.notify_all();
+    // run()/sync() callers that found nothing to do can help with this one
+    if (num_sleeping_waiters_ > 0) {
+        done_cv_.notify_all();
+    }
+}
+
+// Queues task i of `launch` on the worker that ran task i of its affinity
+// predecessor. Tasks without an active recorded worker (the predecessor
+// had fewer tasks, a thread outside the pool ran them, or the worker was
+// parked since) get a static block of the active workers. Must be called
+// with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::queueOnPreferredWorkers(BulkLaunch* launch) {
+    int num_tasks = launch->num_total_tasks_;
+    int num_preferred = launch->preferred_workers_.size();
+    for (int i = 0; i < num_tasks; i++) {
+        int worker_id = (i < num_preferred) ? launch->preferred_workers_[i] : -1;
+        if (worker_id < 0 || worker_id >= num_active_workers_) {
+            worker_id = (long long) i * num_active_workers_ / num_tasks;
+        }
+        worker_queues_[worker_id].push_back(QueuedTask(launch, i));
+    }
+    launch->next_task_ = num_tasks;
+    num_queued_tasks_ += num_tasks;
+}
+
+// Gives active worker w the tasks [w * n / (W + 1), (w + 1) * n / (W + 1))
+// of an n-task launch, W being the number of active workers, queued in
+// pieces of chunk_size_ tasks. The remaining range, [W * n / (W + 1), n),
+// is left on the launch (next_task_) for the waiting thread. Must be
+// called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::queueStatically(BulkLaunch* launch) {
+    int num_tasks = launch->num_total_tasks_;
+    int num_ranges = num_active_workers_ + 1;
+    for (int w = 0; w < num_active_workers_; w++) {
+        int begin = (long long) w * num_tasks / num_ranges;
+        int end = (long long) (w + 1) * num_tasks / num_ranges;
+        for (int i = begin; i < end; i += launch->chunk_size_) {
+            int n = std::min(launch->chunk_size_, end - i);
+            worker_queues_[w].push_back(QueuedTask(launch, i, n));
+            ++num_queued_tasks_;
+        }
+    }
+    launch->next_task_ = (long long) num_active_workers_ * num_tasks / num_ranges;
+}
+
+// Registers `launch` and links it behind the still unfinished launches in
+// `deps`. IDs missing from in_flight_ belong to launches that are already
+// done. Must be called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::submit(BulkLaunch* launch,
+                                                  const std::vector<TaskID>& deps) {
+    in_flight_[launch->id_] = launch;
+    for (TaskID dep : deps) {
+        linkDependency(launch, dep);
+    }
+    if (launch->num_pending_deps_ == 0) {
+        makeReady(launch);
+    }
+}
+
+// Makes `launch` wait for launch `dep` if that one is still in flight.
+// Must be called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::linkDependency(BulkLaunch* launch, TaskID dep) {
+    auto it = in_flight_.find(dep);
+    if (it == in_flight_.end()) return;
+    linkPredecessor(launch, it->second);
+}
+
+// Makes `launch` wait for the unfinished launch `predecessor`. The first
+// successor of a launch is stored inline, so dependency chains link
+// without allocating. Must be called with mutex_ held.
+void TaskSystemParallelThreadPoolSleeping::linkPredecessor(BulkLaunch* launch,
+                                                           BulkLaunch* predecessor) {
+    if (predecessor->first_successor_ == nullptr) {
+        predecessor->first_successor_ = launch;
+    } else {
+        predecessor->successors_.push_back(launch);
+    }
+    ++launch->num_pending_deps_;
 }
 
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
+    std::unique_lock<std::mutex> lk(mutex_);
 
+    TaskCost* cost = &task_costs_[std::type_index(typeid(*runnable))];
+    if (cost->num_samples_ > 0 && num_total_tasks > 0 && !singleTaskClaims() &&
+        cost->ticks_per_task_ * num_total_tasks < inline_launch_ticks_) {
+        lk.unlock();
+        CycleTimer::SysClock start = CycleTimer::currentTicks();
+        for (int i = 0; i < num_total_tasks; i++) {
+            runnable->runTask(i, num_total_tasks);
+        }
+        CycleTimer::SysClock end = CycleTimer::currentTicks();
+        lk.lock();
+        if (end > start) {
+            cost->addSample((double) (end - start) / num_total_tasks);
+        }
+        return;
+    }
 
-    //
-    // TODO: CS149 students will modify the implementation of this
-    // method in Parts A and B.  The implementation provided below runs all
-    // tasks sequentially on the calling thread.
-    //
+    // the record lives on this stack frame: nobody else can name it as a
+    // dependency, and finishLaunch() leaves waited_ records alone
+    BulkLaunch launch(next_id_++, runnable, num_total_tasks);
+    launch.waited_ = true;
+    submit(&launch, std::vector<TaskID>());
 
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
+    while (!launch.done_) {
+        if (runOneTask(lk, &launch)) continue;
+        ++num_sleeping_waiters_;
+        done_cv_.wait(lk);
+        --num_sleeping_waiters_;
     }
 }
 
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                                     const std::vector<TaskID>& deps) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    TaskID id = next_id_++;
+    submit(new BulkLaunch(id, runnable, num_total_tasks), deps);
+    return id;
+}
 
+// The whole batch is linked under one acquisition of mutex_, with
+// intra-batch dependencies resolved by index rather than through
+// in_flight_. Its launches become ready only once the whole batch is
+// linked, and the threads are woken once.
+void TaskSystemParallelThreadPoolSleeping::submitBatch(const LaunchDesc* launches,
+                                                       int num_launches, TaskID* ids) {
+    std::vector<BulkLaunch*> batch(num_launches);
+    std::vector<BulkLaunch*> roots;
+    std::lock_guard<std::mutex> lk(mutex_);
+    in_flight_.reserve(in_flight_.size() + num_launches);
+    for (int i = 0; i < num_launches; i++) {
+        const LaunchDesc& desc = launches[i];
+        BulkLaunch* launch = new BulkLaunch(next_id_++, desc.runnable, desc.num_total_tasks);
+        batch[i] = launch;
+        in_flight_[launch->id_] = launch;
+        for (TaskID dep : desc.deps) {
+            linkDependency(launch, dep);
+        }
+        for (int idx : desc.batch_deps) {
+            checkBatchDep(idx, i);
+            linkPredecessor(launch, batch[idx]);
+        }
+        if (ids != NULL) ids[i] = launch->id_;
+    }
 
-    //
-    // TODO: CS149 students will implement this method in Part B.
-    //
+    // collect roots first: a 0-task root finishes on the spot and readies
+    // its successors itself
+    for (BulkLaunch* launch : batch) {
+        if (launch->num_pending_deps_ == 0) roots.push_back(launch);
+    }
+    bool any_queued = false;
+    for (BulkLaunch* launch : roots) {
+        any_queued |= enqueueReady(launch);
+    }
+    if (any_queued) {
+        wakeThreads();
+    }
+}
 
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
+// Fuses `launch` behind launch `pred_id` when the caller declared them
+// element-wise and it is safe to do so: `pred` is still in flight, has the
+// same number of tasks, has finished none of them yet, has no other fused
+// successor, and is the only dependency not yet complete. A fused launch
+// never enters a ready queue: each of its tasks is run by whichever thread just
+// finished the matching task of `pred` (see runOneTask()). Returns false
+// if the launch must be scheduled normally. Must be called with mutex_
+// held.
+bool TaskSystemParallelThreadPoolSleeping::tryFuse(BulkLaunch* launch,
+                                                   const std::vector<TaskID>& deps,
+                                                   TaskID pred_id) {
+    auto it = in_flight_.find(pred_id);
+    if (it == in_flight_.end()) return false;
+    BulkLaunch* pred = it->second;
+    if (pred->replay_ != nullptr || pred->fused_successor_ != nullptr ||
+        pred->num_total_tasks_ != launch->num_total_tasks_ ||
+        launch->num_total_tasks_ == 0 || pred->tasks_done_ != 0) {
+        return false;
+    }
+    for (TaskID dep : deps) {
+        if (dep != pred_id && in_flight_.count(dep) != 0) return false;
     }
 
-    return 0;
+    pred->fused_successor_ = launch;
+    in_flight_[launch->id_] = launch;
+    return true;
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithHints(IRunnable* runnable, int num_total_tasks,
+                                                             const std::vector<TaskID>& deps,
+                                                             const LaunchHints& hints) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    TaskID id = next_id_++;
+    BulkLaunch* launch = new BulkLaunch(id, runnable, num_total_tasks);
+    ContextID context = hints.context - num_dropped_contexts_;
+    if (context > 0 && context < (ContextID) contexts_.size()) {
+        launch->context_ = context;
+    }
+    if (hints.elementwise_after >= 0 && tryFuse(launch, deps, hints.elementwise_after)) {
+        return id;
+    }
+    if (hints.affinity_with >= 0) {
+        auto it = in_flight_.find(hints.affinity_with);
+        // a predecessor that already finished has no placement left to use
+        if (it != in_flight_.end() && it->second->replay_ == nullptr) {
+            BulkLaunch* source = it->second;
+            if (source->placement_.empty()) {
+                source->placement_.assign(source->num_total_tasks_, -1);
+            }
+            launch->affinity_source_ = source;
+        }
+    }
+    submit(launch, deps);
+    return id;
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncAfter(IRunnable* runnable, int num_total_tasks,
+                                                         TaskID dep) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    TaskID id = next_id_++;
+    BulkLaunch* launch = new BulkLaunch(id, runnable, num_total_tasks);
+    in_flight_[id] = launch;
+    linkDependency(launch, dep);
+    if (launch->num_pending_deps_ == 0) {
+        makeReady(launch);
+    }
+    return id;
 }
 
 void TaskSystemParallelThreadPoolSleeping::sync() {
+    // NOTE: sync() waits for every launch, including the one a runTask()
+    // belongs to, so it must not be called from inside a task. Nested
+    // code should use run().
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (!idle()) {
+        if (runOneTask(lk, nullptr)) continue;
+        ++num_sleeping_waiters_;
+        done_cv_.wait(lk);
+        --num_sleeping_waiters_;
+    }
+}
 
-    //
-    // TODO: CS149 students will modify the implementation of this method in Part B.
-    //
+bool TaskSystemParallelThreadPoolSleeping::idle() const {
+    return in_flight_.empty() && num_replays_in_flight_ == 0;
+}
 
-    return;
+// Returns an idle replay of `graph`, building one the first time the
+// graph is launched (or when all of its replays are still running).
+// Returns nullptr if that would grow the cache past
+// MAX_CACHED_GRAPH_REPLAYS because every cached replay is busy.
+// Must be called with mutex_ held.
+GraphReplay* TaskSystemParallelThreadPoolSleeping::replayFor(const TaskGraph& graph) {
+    for (GraphReplay* replay : graph_replays_) {
+        if (!replay->busy_ && replay->graph_id_ == graph.id()) return replay;
+    }
+
+    // bound the cache: forget the oldest idle replay of some other graph
+    if (graph_replays_.size() >= MAX_CACHED_GRAPH_REPLAYS) {
+        size_t i = 0;
+        while (i < graph_replays_.size() && graph_replays_[i]->busy_) i++;
+        if (i == graph_replays_.size()) return nullptr;
+        delete graph_replays_[i];
+        graph_replays_.erase(graph_replays_.begin() + i);
+    }
+
+    int n = graph.numNodes();
+    GraphReplay* replay = new GraphReplay();
+    replay->graph_id_ = graph.id();
+    replay->busy_ = false;
+    replay->nodes_.reserve(n);
+    replay->indegrees_.resize(n);
+    replay->roots_ = graph.roots();
+    int num_edges = 0;
+    for (int i = 0; i < n; i++) {
+        const TaskGraph::Node& node = graph.node(i);
+        replay->nodes_.emplace_back(-1, node.runnable, node.num_total_tasks);
+        replay->indegrees_[i] = node.indegree;
+        num_edges += node.num_successors;
+    }
+    replay->successors_.resize(num_edges);
+    for (int i = 0; i < n; i++) {
+        const TaskGraph::Node& node = graph.node(i);
+        BulkLaunch& launch = replay->nodes_[i];
+        launch.replay_ = replay;
+        launch.graph_successors_ = replay->successors_.data() + node.first_successor;
+        launch.num_graph_successors_ = node.num_successors;
+        for (int s = 0; s < node.num_successors; s++) {
+            replay->successors_[node.first_successor + s] =
+                &replay->nodes_[graph.successors(i)[s]];
+        }
+    }
+    graph_replays_.push_back(replay);
+    return replay;
+}
+
+void TaskSystemParallelThreadPoolSleeping::launch(const TaskGraph& graph) {
+    if (graph.numNodes() == 0) return;
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    GraphReplay* replay = replayFor(graph);
+    if (replay == nullptr) {
+        // every cached replay is running: launch node by node, uncached
+        lk.unlock();
+        graph.replay(this);
+        return;
+    }
+
+    // resetting counters is the only per-node work of a relaunch
+    for (size_t i = 0; i < replay->nodes_.size(); i++) {
+        BulkLaunch& launch = replay->nodes_[i];
+        launch.next_task_ = 0;
+        launch.tasks_done_ = 0;
+        launch.num_pending_deps_ = replay->indegrees_[i];
+        launch.done_ = false;
+    }
+    replay->nodes_remaining_ = replay->nodes_.size();
+    replay->busy_ = true;
+    ++num_replays_in_flight_;
+
+    for (int root : replay->roots_) {
+        makeReady(&replay->nodes_[root]);
+    }
+}
+
+ContextID TaskSystemParallelThreadPoolSleeping::createContext(const char* name, int weight) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    contexts_.push_back(SubmissionContext(name, std::max(weight, 1)));
+    return contexts_.size() - 1 + num_dropped_contexts_;
+}
+
+// Later contexts get fresh ContextIDs, so launches hinted with a dropped
+// one fall back to the default context instead of reaching a new tenant.
+void TaskSystemParallelThreadPoolSleeping::dropContexts() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!in_flight_.empty() || num_replays_in_flight_ > 0) {
+        fprintf(stderr, "dropContexts: called with launches outstanding\n");
+        abort();
+    }
+    num_dropped_contexts_ += contexts_.size() - 1;
+    contexts_.erase(contexts_.begin() + 1, contexts_.end());
+}
+
+void TaskSystemParallelThreadPoolSleeping::setConcurrency(int num_threads) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    resizeWorkers(std::max(num_threads, 1));
+    // woken workers recheck whether they are still active
+    work_cv_.notify_all();
+}
+
+// the active workers plus the thread waiting in run() or sync()
+int TaskSystemParallelThreadPoolSleeping::numThreads() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return num_active_workers_ + 1;
+}
+
+void TaskSystemParallelThreadPoolSleeping::setIdleShrinkTimeout(double seconds) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    idle_shrink_timeout_ = std::max(seconds, 0.0);
+    // waiting workers pick up the new timeout
+    work_cv_.notify_all();
+}
+
+void TaskSystemParallelThreadPoolSleeping::setStaticScheduling(bool enable) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    static_scheduling_ = enable;
+}
+
+void TaskSystemParallelThreadPoolSleeping::recordSchedule(bool enable) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    recording_ = enable;
+}
+
+std::vector<ScheduleEvent> TaskSystemParallelThreadPoolSleeping::recordedSchedule() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return recorded_;
+}
+
+void TaskSystemParallelThreadPoolSleeping::replaySchedule(const std::vector<ScheduleEvent>& schedule) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    replay_ = schedule;
+    replay_pos_ = 0;
+    if (replaying() && num_running_tasks_ == 0) {
+        checkReplayStalled();
+    }
+    work_cv_.notify_all();
+}
+
+void TaskSystemParallelThreadPoolSleeping::setRandomScheduling(bool enable, unsigned int seed) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    random_scheduling_ = enable;
+    rng_.seed(seed);
 }
@@ -2,6 +2,17 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
+#include "taskgraph.h"
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <random>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -53,11 +64,156 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
         void sync();
 };
 
+struct GraphReplay;
+
+/*
+ * TaskCost: exponentially decayed estimate of how long one task of a
+ * runnable type takes, in CycleTimer ticks. Every claimed chunk of tasks
+ * contributes a sample; the newest sample gets weight TASK_COST_DECAY.
+ */
+const double TASK_COST_DECAY = 0.125;
+
+struct TaskCost {
+    double ticks_per_task_;
+    int num_samples_;
+    TaskCost() : ticks_per_task_(0), num_samples_(0) {}
+    void addSample(double ticks_per_task) {
+        if (num_samples_++ == 0) {
+            ticks_per_task_ = ticks_per_task;
+        } else {
+            ticks_per_task_ += TASK_COST_DECAY * (ticks_per_task - ticks_per_task_);
+        }
+    }
+};
+
+// tasks are claimed in chunks of about this much work, once their cost is
+// known, so cheap tasks do not pay a lock round trip each
+const double TARGET_CHUNK_SECONDS = 20e-6;
+// run() launches predicted to take less than this run inline on the
+// caller, as waking workers would cost more than it saves
+const double INLINE_LAUNCH_SECONDS = 10e-6;
+// chunks are kept small enough for every thread to get at least this many,
+// so a badly predicted chunk cannot leave the others idle
+const int MIN_CHUNKS_PER_THREAD = 4;
+
+// idle GraphReplays kept per task system for relaunching graphs
+const size_t MAX_CACHED_GRAPH_REPLAYS = 16;
+
+/*
+ * BulkLaunch: bookkeeping for a single run()/runAsyncWithDeps() call.
+ * Each launch carries its own runnable and task counters, so any number
+ * of launches (including launches made from inside runTask()) can be in
+ * flight at once. All fields are guarded by the owning task system's
+ * mutex_.
+ */
+struct BulkLaunch {
+    TaskID id_;
+    IRunnable* runnable_;
+    int num_total_tasks_;
+    int next_task_;        // next task index to hand out
+    int chunk_size_;       // tasks handed out per claim
+    int tasks_done_;
+    int num_pending_deps_; // launches that must finish before this one starts
+    BulkLaunch* first_successor_;
+    std::vector<BulkLaunch*> successors_; // successors after the first
+    bool done_;
+    bool waited_;          // a run() caller owns the record and frees it
+    ContextID context_;    // submission context whose ready queue it joins
+    TaskCost* cost_;       // cost model of the runnable's type, looked up lazily
+
+    // affinity hint: placement_[i] is the worker that ran task i (-1 if
+    // unknown), recorded only when a successor asked for it; the
+    // successor gets a copy in preferred_workers_ once this launch is done
+    BulkLaunch* affinity_source_;
+    std::vector<int> placement_;
+    std::vector<int> preferred_workers_;
+
+    // element-wise successor whose task i runs right after task i of this
+    // launch (LaunchHints::elementwise_after)
+    BulkLaunch* fused_successor_;
+
+    // set for nodes of a launched TaskGraph: successors come from the
+    // replay's precomputed array and the replay owns the record
+    GraphReplay* replay_;
+    BulkLaunch* const* graph_successors_;
+    int num_graph_successors_;
+
+    BulkLaunch(TaskID id, IRunnable* runnable, int num_total_tasks)
+        : id_(id), runnable_(runnable), num_total_tasks_(num_total_tasks),
+          next_task_(0), chunk_size_(1), tasks_done_(0), num_pending_deps_(0),
+          first_successor_(nullptr), done_(false), waited_(false), context_(0),
+          cost_(nullptr), affinity_source_(nullptr), fused_successor_(nullptr), replay_(nullptr),
+          graph_successors_(nullptr), num_graph_successors_(0) {}
+};
+
+// tasks a context of weight 1 may claim per deficit round-robin turn
+const int DRR_QUANTUM_TASKS = 8;
+
+/*
+ * SubmissionContext: the ready launches of one tenant (see
+ * ITaskSystem::createContext()), served in FIFO order. Contexts with
+ * ready launches take turns in deficit round-robin order; deficit_ is how
+ * many more tasks the context may claim in its current turn.
+ */
+struct SubmissionContext {
+    std::string name_;
+    int weight_;
+    int deficit_;
+    bool active_;                      // listed in active_contexts_
+    std::deque<BulkLaunch*> ready_;    // launches with unclaimed tasks
+    SubmissionContext(const char* name, int weight)
+        : name_(name), weight_(weight), deficit_(0), active_(false) {}
+};
+
+/*
+ * QueuedTask: tasks task_id_ .. task_id_ + num_tasks_ - 1 of a launch,
+ * placed on a specific worker's queue and claimed together.
+ */
+struct QueuedTask {
+    BulkLaunch* launch_;
+    int task_id_;
+    int num_tasks_;
+    QueuedTask(BulkLaunch* launch, int task_id, int num_tasks = 1)
+        : launch_(launch), task_id_(task_id), num_tasks_(num_tasks) {}
+};
+
+/*
+ * GraphReplay: the BulkLaunch records for one in-flight launch of a
+ * TaskGraph, with successor pointers resolved once when the replay is
+ * built. Idle replays are kept and reset for later launches of the same
+ * graph, so relaunching a graph allocates nothing.
+ */
+struct GraphReplay {
+    int graph_id_;
+    std::vector<BulkLaunch> nodes_;
+    std::vector<BulkLaunch*> successors_;
+    std::vector<int> indegrees_;
+    std::vector<int> roots_;
+    int nodes_remaining_;
+    bool busy_;
+};
+
 /*
  * TaskSystemParallelThreadPoolSleeping: This class is the student's
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * The pool starts num_threads - 1 workers; the thread blocked in run() or
+ * sync() executes tasks too, so at most num_threads threads do work.
+ * run() may be called from inside IRunnable::runTask(): the waiting
+ * thread keeps executing ready tasks (its own launch first) until the
+ * nested launch completes, instead of blocking a pool thread.
+ * runAsyncWithHints() honors all LaunchHints, and ready launches of
+ * different submission contexts share the threads by weighted deficit
+ * round-robin. The number of workers can be changed at any time with
+ * setConcurrency(), and idle workers can be retired after a timeout.
+ * In static scheduling mode each worker gets the same task ranges on
+ * every launch.
+ * Task claims can be recorded, replayed, or randomized for debugging.
+ * Task durations are sampled into a per-runnable-type cost model that
+ * sets the chunk size of later launches and lets run() execute cheap
+ * launches inline.
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
@@ -67,7 +223,90 @@ class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
         void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
+        TaskID runAsyncAfter(IRunnable* runnable, int num_total_tasks, TaskID dep);
+        TaskID runAsyncWithHints(IRunnable* runnable, int num_total_tasks,
+                                 const std::vector<TaskID>& deps,
+                                 const LaunchHints& hints);
+        void submitBatch(const LaunchDesc* launches, int num_launches, TaskID* ids);
         void sync();
+        void launch(const TaskGraph& graph);
+        ContextID createContext(const char* name, int weight);
+        void dropContexts();
+        void setConcurrency(int num_threads);
+        int numThreads();
+        void setIdleShrinkTimeout(double seconds);
+        void setStaticScheduling(bool enable);
+        void recordSchedule(bool enable);
+        std::vector<ScheduleEvent> recordedSchedule();
+        void replaySchedule(const std::vector<ScheduleEvent>& schedule);
+        void setRandomScheduling(bool enable, unsigned int seed);
+
+    private:
+        bool idle() const;
+        GraphReplay* replayFor(const TaskGraph& graph);
+        void workerLoop(int worker_id);
+        void resizeWorkers(int num_threads);
+        void restartRetiredWorkers();
+        int currentWorkerId() const;
+        TaskCost* costOf(BulkLaunch* launch);
+        int chunkSize(BulkLaunch* launch);
+        bool singleTaskClaims() const;
+        int takeTasks(BulkLaunch* launch, int num_tasks);
+        BulkLaunch* nextReadyLaunch();
+        void startTurn();
+        bool claimTask(BulkLaunch* preferred, int worker_id,
+                       BulkLaunch** launch, int* task_id, int* num_tasks);
+        bool replaying() const;
+        bool replayTurn(int worker_id) const;
+        bool claimReplayedTask(int worker_id, BulkLaunch** launch, int* task_id);
+        void checkReplayStalled();
+        void stopReplay(const char* reason);
+        bool claimRandomTask(BulkLaunch** launch, int* task_id, int* num_tasks);
+        void queueOnPreferredWorkers(BulkLaunch* launch);
+        void queueStatically(BulkLaunch* launch);
+        bool tryFuse(BulkLaunch* launch, const std::vector<TaskID>& deps, TaskID pred_id);
+        void submit(BulkLaunch* launch, const std::vector<TaskID>& deps);
+        void linkDependency(BulkLaunch* launch, TaskID dep);
+        void linkPredecessor(BulkLaunch* launch, BulkLaunch* predecessor);
+        void releaseSuccessor(BulkLaunch* launch, BulkLaunch* successor);
+        void makeReady(BulkLaunch* launch);
+        bool enqueueReady(BulkLaunch* launch);
+        void wakeThreads();
+        bool runOneTask(std::unique_lock<std::mutex>& lk, BulkLaunch* preferred);
+        void finishTasks(BulkLaunch* launch, int num_tasks);
+        void finishLaunch(BulkLaunch* launch);
+
+        std::vector<std::thread> threads_;  // indexed by worker id
+        std::vector<bool> retired_;         // worker exited after idle_shrink_timeout_
+        std::mutex mutex_;
+        std::condition_variable work_cv_;   // workers sleep here when idle
+        std::condition_variable done_cv_;   // run()/sync() callers sleep here
+        std::vector<SubmissionContext> contexts_; // [0] is the default context
+        ContextID num_dropped_contexts_;     // contexts_[i] has ContextID i + this, for i >= 1
+        std::deque<ContextID> active_contexts_;   // contexts_ indices with ready launches, in turn order
+        int num_ready_launches_;
+        std::vector<std::deque<QueuedTask> > worker_queues_; // affinity-placed tasks
+        std::unordered_map<TaskID, BulkLaunch*> in_flight_;
+        std::vector<GraphReplay*> graph_replays_;
+        int num_replays_in_flight_;
+        int num_queued_tasks_;              // QueuedTasks in worker_queues_
+        TaskID next_id_;
+        int num_sleeping_waiters_;
+        int num_active_workers_;            // workers with a lower id may claim tasks
+        int num_retired_workers_;
+        double idle_shrink_timeout_;        // seconds; 0 keeps idle workers forever
+        bool static_scheduling_;            // queue task ranges with queueStatically()
+        bool recording_;                    // append every claim to recorded_
+        std::vector<ScheduleEvent> recorded_;
+        std::vector<ScheduleEvent> replay_; // claims still to be replayed from replay_pos_ on
+        size_t replay_pos_;
+        bool random_scheduling_;
+        std::mt19937 rng_;
+        int num_running_tasks_;             // claimed and not yet finished
+        std::unordered_map<std::type_index, TaskCost> task_costs_;
+        double target_chunk_ticks_;
+        double inline_launch_ticks_;
+        bool stop_;
 };
 
 #endif
@@ -0,0 +1,81 @@
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * LatencyHistogram: an HDR-style histogram of nanosecond latencies.
+ * Values below 128 ns get a bucket each; above that, every power of two
+ * is split into 64 equal buckets, so any recorded value is known to
+ * within 1/64 (~1.6%) over the whole range, in a fixed ~30 KB of
+ * counters and O(1) per record().
+ */
+class LatencyHistogram {
+    public:
+        static const int SUB_BUCKETS = 64;
+
+        LatencyHistogram() : counts_(2 * SUB_BUCKETS + 57 * SUB_BUCKETS, 0), total_(0), max_(0) {}
+
+        void record(uint64_t ns) {
+            counts_[bucketOf(ns)]++;
+            total_++;
+            if (ns > max_) max_ = ns;
+        }
+
+        void clear() {
+            counts_.assign(counts_.size(), 0);
+            total_ = 0;
+            max_ = 0;
+        }
+
+        uint64_t count() const { return total_; }
+        uint64_t max() const { return max_; }
+
+        /*
+          Smallest bucket upper bound below which at least `fraction` of the
+          recorded values lie (fraction in [0, 1]). 0 if nothing was recorded.
+         */
+        uint64_t percentile(double fraction) const {
+            if (total_ == 0) return 0;
+            uint64_t rank = (uint64_t) (fraction * total_);
+            if (rank >= total_) rank = total_ - 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < counts_.size(); i++) {
+                seen += counts_[i];
+                if (seen > rank) {
+                    uint64_t upper = upperBoundOf(i);
+                    return upper < max_ ? upper : max_;
+                }
+            }
+            return max_;
+        }
+
+    private:
+        static int highestBit(uint64_t v) {
+            int bit = 0;
+            while (v >>= 1) bit++;
+            return bit;
+        }
+
+        static size_t bucketOf(uint64_t v) {
+            if (v < 2 * SUB_BUCKETS) return v;
+            // v >> shift lies in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+            int shift = highestBit(v) - 6;
+            return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + ((v >> shift) - SUB_BUCKETS);
+        }
+
+        static uint64_t upperBoundOf(size_t index) {
+            if (index < 2 * SUB_BUCKETS) return index;
+            int shift = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+            uint64_t sub = (index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+            return ((sub + 1) << shift) - 1;
+        }
+
+        std::vector<uint64_t> counts_;
+        uint64_t total_;
+        uint64_t max_;
+};
+
+#endif
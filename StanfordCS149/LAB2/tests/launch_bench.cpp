@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+#include "tasksys_select.h"
+
+/*
+ * Launch-overhead microbenchmarks: every task is empty, so the numbers
+ * are the task systems' own dispatch costs. For each TaskSystemType:
+ *
+ *  - empty launch: run() of 1, N, 10N and 1M empty tasks (N = number of
+ *    threads);
+ *  - submit to start: from calling runAsyncWithDeps() on an idle task
+ *    system to the start of the launch's only task;
+ *  - wake from idle: submit to start of a launch issued after the task
+ *    system was left idle for 0, 1, 10 and 100 ms;
+ *  - dependency chain: runAsyncWithDeps() chains of 1..10k one-task
+ *    launches, each depending on the previous one, up to sync().
+ *
+ * Latencies are medians over the samples of all timing iterations.
+ */
+
+#define DEFAULT_NUM_THREADS 8
+#define DEFAULT_NUM_TIMING_ITERATIONS 3
+
+// seconds of empty launches of one size per timing iteration
+const double LAUNCH_TIME_BUDGET = 0.5;
+
+void usage(const char* progname) {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
+    printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -?  --help                    This message\n");
+}
+
+class EmptyTask : public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {}
+};
+
+/*
+ * Records when the first of its tasks started.
+ */
+class StartStampTask : public IRunnable {
+    public:
+        std::atomic<bool> started_;
+        double start_time_;
+
+        StartStampTask() : started_(false), start_time_(0) {}
+
+        void reset() {
+            started_ = false;
+            start_time_ = 0;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            double now = CycleTimer::currentSeconds();
+            bool expected = false;
+            if (started_.compare_exchange_strong(expected, true))
+                start_time_ = now;
+        }
+};
+
+double median(std::vector<double> samples) {
+    if (samples.empty()) return -1;
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// prints a latency in microseconds, or n/a for task systems that never ran
+// the measured tasks (async launches of the part A task systems)
+void printLatency(const char* label, double seconds) {
+    if (seconds < 0)
+        printf("    %-28s %12s\n", label, "n/a");
+    else
+        printf("    %-28s %12.2f us\n", label, seconds * 1e6);
+}
+
+void benchEmptyLaunches(ITaskSystem* t, int num_threads, int num_iterations) {
+    EmptyTask task;
+    int sizes[] = {1, num_threads, 10 * num_threads, 1000 * 1000};
+    for (int size : sizes) {
+        // about the same number of tasks for every size, between 3 and
+        // 1000 launches, and no more than LAUNCH_TIME_BUDGET seconds'
+        // worth of them (spinning pools crawl on oversubscribed machines)
+        int num_launches = std::max(3, std::min(1000, 100000 / size));
+        std::vector<double> samples;
+        for (int it = 0; it < num_iterations; it++) {
+            double budget_end = CycleTimer::currentSeconds() + LAUNCH_TIME_BUDGET;
+            for (int i = 0; i < num_launches; i++) {
+                double start = CycleTimer::currentSeconds();
+                t->run(&task, size);
+                samples.push_back(CycleTimer::currentSeconds() - start);
+                if (i >= 2 && start > budget_end) break;
+            }
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "empty launch, %d tasks", size);
+        printLatency(label, median(samples));
+    }
+}
+
+// Submit-to-start latency of a one-task launch, issued after the task
+// system has been idle for idle_ms. Returns -1 if the task never ran.
+double submitToStart(ITaskSystem* t, StartStampTask* task, int idle_ms) {
+    std::vector<TaskID> no_deps;
+    t->sync();
+    if (idle_ms > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(idle_ms));
+    task->reset();
+    double submit_time = CycleTimer::currentSeconds();
+    t->runAsyncWithDeps(task, 1, no_deps);
+    t->sync();
+    return task->started_ ? task->start_time_ - submit_time : -1;
+}
+
+void benchSubmitToStart(ITaskSystem* t, int num_iterations) {
+    StartStampTask task;
+    int idle_times_ms[] = {0, 1, 10, 100};
+    for (int idle_ms : idle_times_ms) {
+        int num_samples = (idle_ms >= 100) ? 3 : 20;
+        std::vector<double> samples;
+        bool ran = true;
+        for (int it = 0; it < num_iterations; it++) {
+            for (int i = 0; i < num_samples; i++) {
+                double latency = submitToStart(t, &task, idle_ms);
+                if (latency < 0) ran = false;
+                samples.push_back(latency);
+            }
+        }
+        char label[64];
+        if (idle_ms == 0)
+            snprintf(label, sizeof(label), "submit to start");
+        else
+            snprintf(label, sizeof(label), "wake after %d ms idle", idle_ms);
+        printLatency(label, ran ? median(samples) : -1);
+    }
+}
+
+void benchDependencyChains(ITaskSystem* t, int num_iterations) {
+    StartStampTask last;
+    EmptyTask task;
+    int lengths[] = {1, 10, 100, 1000, 10000};
+    for (int length : lengths) {
+        std::vector<double> samples;
+        bool ran = true;
+        for (int it = 0; it < num_iterations; it++) {
+            last.reset();
+            std::vector<TaskID> deps;
+            double start = CycleTimer::currentSeconds();
+            for (int i = 0; i < length; i++) {
+                IRunnable* runnable = (i + 1 == length) ? (IRunnable*) &last : &task;
+                TaskID id = t->runAsyncWithDeps(runnable, 1, deps);
+                deps.assign(1, id);
+            }
+            t->sync();
+            samples.push_back((CycleTimer::currentSeconds() - start) / length);
+            if (!last.started_) ran = false;
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "chain of %d, per launch", length);
+        printLatency(label, ran ? median(samples) : -1);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int num_threads = DEFAULT_NUM_THREADS;
+    int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+
+    int opt;
+    static struct option long_options[] = {
+        {"num_threads",           1, 0,  'n'},
+        {"num_timing_iterations", 1, 0,  'i'},
+        {"help",                  0, 0,  '?'},
+    };
+
+    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+        switch (opt) {
+        case 'n':
+            num_threads = atoi(optarg);
+            break;
+        case 'i':
+            num_timing_iterations = atoi(optarg);
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("============================================================="
+           "======================\n");
+    printf("Launch overhead (%d threads, median of %d iterations)\n",
+           num_threads, num_timing_iterations);
+    printf("============================================================="
+           "======================\n");
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+        printf("[%s]:\n", t->name());
+        benchEmptyLaunches(t, num_threads, num_timing_iterations);
+        benchSubmitToStart(t, num_timing_iterations);
+        benchDependencyChains(t, num_timing_iterations);
+        delete t;
+    }
+    printf("============================================================="
+           "======================\n");
+    return 0;
+}
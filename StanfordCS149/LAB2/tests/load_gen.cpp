@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+#include "tasksys_select.h"
+#include "latency_histogram.h"
+
+/*
+ * Open-loop load generator. Requests, each an async launch of a few
+ * fixed-cost tasks, are submitted with runAsyncWithDeps() at Poisson
+ * arrival times, whether or not earlier requests have finished, and each
+ * request's latency runs from its scheduled arrival to the end of its
+ * last task. Measuring from the schedule rather than from the actual
+ * submission keeps a task system that blocks the submitter from hiding
+ * its queueing delay (coordinated omission).
+ *
+ * For each TaskSystemType the service capacity is first estimated
+ * closed-loop; offered load is then swept from 10% to 120% of it,
+ * printing achieved throughput and latency percentiles per step: the
+ * p99-vs-throughput curve.
+ */
+
+#define DEFAULT_NUM_THREADS 8
+#define DEFAULT_STEP_SECONDS 0.5
+#define DEFAULT_TASKS_PER_REQUEST 8
+#define DEFAULT_TASK_MICROSECONDS 20
+
+void usage(const char* progname) {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
+    printf("  -d  --step_seconds <FLOAT>    Seconds of arrivals per load step (default=%.1f)\n", DEFAULT_STEP_SECONDS);
+    printf("  -t  --tasks_per_request <INT> Tasks per request launch (default=%d)\n", DEFAULT_TASKS_PER_REQUEST);
+    printf("  -w  --task_us <INT>           Microseconds of work per task (default=%d)\n", DEFAULT_TASK_MICROSECONDS);
+    printf("  -?  --help                    This message\n");
+}
+
+/*
+ * One request: its tasks spin for task_seconds_ each, and the last one to
+ * finish stamps the completion time.
+ */
+class Request : public IRunnable {
+    public:
+        double task_seconds_;
+        double arrival_time_;
+        std::atomic<int> tasks_left_;
+        double finish_time_;
+
+        Request() : task_seconds_(0), arrival_time_(0), tasks_left_(0), finish_time_(0) {}
+
+        void reset(double task_seconds, double arrival_time, int num_tasks) {
+            task_seconds_ = task_seconds;
+            arrival_time_ = arrival_time;
+            tasks_left_ = num_tasks;
+            finish_time_ = 0;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            double start = CycleTimer::currentSeconds();
+            while (CycleTimer::currentSeconds() - start < task_seconds_);
+            if (--tasks_left_ == 0)
+                finish_time_ = CycleTimer::currentSeconds();
+        }
+};
+
+struct StepResult {
+    double offered_rate;
+    double achieved_rate;   // completions per second over the whole step
+    bool all_ran;
+};
+
+/*
+ * Submits `requests` at Poisson arrivals of `rate` per second (0 submits
+ * them back to back) and waits for all of them. Latencies go to `hist`.
+ */
+StepResult runStep(ITaskSystem* t, std::vector<Request>& requests, double rate,
+                   double task_seconds, int tasks_per_request,
+                   std::mt19937_64& rng, LatencyHistogram* hist) {
+    std::exponential_distribution<double> gap(rate > 0 ? rate : 1.0);
+    std::vector<TaskID> no_deps;
+    double start = CycleTimer::currentSeconds();
+    double arrival = start;
+    for (Request& request : requests) {
+        if (rate > 0) {
+            arrival += gap(rng);
+            double now;
+            while ((now = CycleTimer::currentSeconds()) < arrival) {
+                if (arrival - now > 200e-6)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        } else {
+            arrival = CycleTimer::currentSeconds();
+        }
+        request.reset(task_seconds, arrival, tasks_per_request);
+        t->runAsyncWithDeps(&request, tasks_per_request, no_deps);
+    }
+    t->sync();
+
+    StepResult result;
+    result.offered_rate = rate;
+    result.all_ran = true;
+    double last_finish = start;
+    for (Request& request : requests) {
+        if (request.tasks_left_ != 0) {
+            result.all_ran = false;
+            continue;
+        }
+        hist->record((uint64_t) ((request.finish_time_ - request.arrival_time_) * 1e9));
+        last_finish = std::max(last_finish, request.finish_time_);
+    }
+    result.achieved_rate = requests.size() / (last_finish - start);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int num_threads = DEFAULT_NUM_THREADS;
+    double step_seconds = DEFAULT_STEP_SECONDS;
+    int tasks_per_request = DEFAULT_TASKS_PER_REQUEST;
+    int task_us = DEFAULT_TASK_MICROSECONDS;
+
+    int opt;
+    static struct option long_options[] = {
+        {"num_threads",       1, 0,  'n'},
+        {"step_seconds",      1, 0,  'd'},
+        {"tasks_per_request", 1, 0,  't'},
+        {"task_us",           1, 0,  'w'},
+        {"help",              0, 0,  '?'},
+    };
+
+    while ((opt = getopt_long(argc, argv, "n:d:t:w:?", long_options, NULL)) != EOF) {
+        switch (opt) {
+        case 'n':
+            num_threads = atoi(optarg);
+            break;
+        case 'd':
+            step_seconds = atof(optarg);
+            break;
+        case 't':
+            tasks_per_request = atoi(optarg);
+            break;
+        case 'w':
+            task_us = atoi(optarg);
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    double task_seconds = task_us * 1e-6;
+    double load_fractions[] = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 0.95, 1.0, 1.1, 1.2};
+    std::mt19937_64 rng(1);
+
+    printf("============================================================="
+           "======================\n");
+    printf("Open-loop load (%d threads, %d x %d us tasks per request, %.1f s per step)\n",
+           num_threads, tasks_per_request, task_us, step_seconds);
+    printf("============================================================="
+           "======================\n");
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+        printf("[%s]:\n", t->name());
+
+        // capacity: requests submitted back to back
+        LatencyHistogram hist;
+        int num_capacity_requests = std::max(10, (int) (step_seconds / (tasks_per_request * task_seconds)));
+        std::vector<Request> capacity_requests(num_capacity_requests);
+        StepResult capacity = runStep(t, capacity_requests, 0, task_seconds,
+                                      tasks_per_request, rng, &hist);
+        if (!capacity.all_ran) {
+            printf("    requests never ran (no async launches)\n");
+            delete t;
+            continue;
+        }
+        printf("    capacity %.0f req/s\n", capacity.achieved_rate);
+        printf("    %12s %12s %12s %12s %12s %12s\n", "offered/s", "achieved/s",
+               "p50 us", "p99 us", "p99.9 us", "max us");
+
+        for (double fraction : load_fractions) {
+            double rate = fraction * capacity.achieved_rate;
+            std::vector<Request> requests(std::max(10, (int) (rate * step_seconds)));
+            hist.clear();
+            StepResult step = runStep(t, requests, rate, task_seconds,
+                                      tasks_per_request, rng, &hist);
+            printf("    %12.0f %12.0f %12.1f %12.1f %12.1f %12.1f\n",
+                   step.offered_rate, step.achieved_rate,
+                   hist.percentile(0.5) * 1e-3, hist.percentile(0.99) * 1e-3,
+                   hist.percentile(0.999) * 1e-3, hist.max() * 1e-3);
+        }
+        delete t;
+    }
+    printf("============================================================="
+           "======================\n");
+    return 0;
+}
@@ -5,7 +5,11 @@
 #include <assert.h>
 
 #include "tasksys.h"
+#include "tasksys_select.h"
 #include "tests.h"
+#include "schedule_log.h"
+#include "perf_counters.h"
+#include "resource_usage.h"
 
 #define DEFAULT_NUM_THREADS 8
 #define DEFAULT_NUM_TIMING_ITERATIONS 3
@@ -13,9 +17,16 @@
 
 void usage(const char* progname, std::string *testnames, int num_tests) {
     printf("Usage: %s [options] testname\n", progname);
+    printf("       %s [options] --all\n", progname);
     printf("Program Options:\n");
     printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
     printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -r  --record_schedule <FILE>  Write the task claims of the last run to <FILE>\n");
+    printf("  -p  --replay_schedule <FILE>  Replay the task claims recorded in <FILE>\n");
+    printf("  -s  --random_seed <INT>       Schedule randomly, seeded with <INT>\n");
+    printf("  -c  --counters                Report perf counters per test and per worker\n");
+    printf("  -u  --usage                   Report CPU time and energy of the timed region\n");
+    printf("  -a  --all                     Run every test on one long-lived task system per type\n");
     printf("  -?  --help                    This message\n");
     printf("Valid testnames are:");
     for(int i = 0; i < num_tests; i++) {
@@ -23,35 +34,113 @@ void usage(const char* progname, std::string *testnames, int num_tests) {
     }
 }
 
-enum TaskSystemType {
-    SERIAL,
-    PARALLEL_SPAWN,
-    PARALLEL_THREAD_POOL_SPINNING,
-    PARALLEL_THREAD_POOL_SLEEPING,
-    N_TASKSYS_IMPLS, // This must be in the last position.
-};
-
-ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
-    assert(type < N_TASKSYS_IMPLS);
-
-    if (type == SERIAL) {
-        return new TaskSystemSerial(num_threads);
-    } else if (type == PARALLEL_SPAWN) {
-        return new TaskSystemParallelSpawn(num_threads);
-    } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
-        return new TaskSystemParallelThreadPoolSpinning(num_threads);
-    } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
-        return new TaskSystemParallelThreadPoolSleeping(num_threads);
-    } else {
-        return NULL;
+/*
+ * Puts a long-lived task system back into the state a new one starts in,
+ * since tests may resize it, change its scheduling or create contexts.
+ */
+void resetTaskSystem(ITaskSystem* t, int num_threads, bool random_scheduling,
+                     unsigned int random_seed) {
+    t->setConcurrency(num_threads);
+    t->setIdleShrinkTimeout(0);
+    t->setStaticScheduling(false);
+    t->setRandomScheduling(random_scheduling, random_seed);
+    t->dropContexts();
+}
+
+/*
+ * --all: every test runs against one instance of each task system that
+ * lives for the whole sweep, the way a pool serves work after hours of
+ * uptime, next to a run on a newly constructed instance:
+ *
+ *   fresh  the test on a new instance, as a single-test invocation runs it
+ *   first  the test's first run on the long-lived instance, which has
+ *          already run every test before it
+ *   warm   the fastest of the remaining num_timing_iterations - 1 runs
+ *
+ * A failing test is reported and the sweep goes on. Returns the number of
+ * failures.
+ */
+int runAllTests(TestResults (**test)(ITaskSystem*), std::string* test_names, int n_tests,
+                int num_threads, int num_timing_iterations,
+                bool random_scheduling, unsigned int random_seed) {
+    int num_failed = 0;
+    printf("============================================================="
+           "======================\n");
+    printf("All tests, one long-lived task system per type\n");
+    printf("============================================================="
+           "======================\n");
+    for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        double construct_start = CycleTimer::currentSeconds();
+        ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+        double construct_time = CycleTimer::currentSeconds() - construct_start;
+        printf("[%s]:\t\t(constructed in %.3f ms)\n", t->name(), construct_time * 1000);
+        printf("    %-56s %10s %10s %10s\n", "test", "fresh ms", "first ms", "warm ms");
+
+        double total_fresh = 0, total_first = 0, total_warm = 0;
+        for (int test_id = 0; test_id < n_tests; test_id++) {
+            ITaskSystem *fresh_t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+            if (random_scheduling)
+                fresh_t->setRandomScheduling(true, random_seed);
+            TestResults fresh = test[test_id](fresh_t);
+            delete fresh_t;
+
+            resetTaskSystem(t, num_threads, random_scheduling, random_seed);
+            TestResults first = test[test_id](t);
+            bool passed = fresh.passed && first.passed;
+            double warm = 1e30;
+            for (int j = 1; j < num_timing_iterations && passed; j++) {
+                resetTaskSystem(t, num_threads, random_scheduling, random_seed);
+                TestResults result = test[test_id](t);
+                passed = result.passed;
+                warm = std::min(warm, result.time);
+            }
+
+            if (!passed) {
+                printf("    %-56s FAILED correctness check\n", test_names[test_id].c_str());
+                num_failed++;
+                continue;
+            }
+            total_fresh += fresh.time;
+            total_first += first.time;
+            if (num_timing_iterations > 1) {
+                total_warm += warm;
+                printf("    %-56s %10.3f %10.3f %10.3f\n", test_names[test_id].c_str(),
+                       fresh.time * 1000, first.time * 1000, warm * 1000);
+            } else {
+                printf("    %-56s %10.3f %10.3f %10s\n", test_names[test_id].c_str(),
+                       fresh.time * 1000, first.time * 1000, "n/a");
+            }
+        }
+        if (num_timing_iterations > 1) {
+            printf("    %-56s %10.3f %10.3f %10.3f\n", "total (passed tests)",
+                   total_fresh * 1000, total_first * 1000, total_warm * 1000);
+        } else {
+            printf("    %-56s %10.3f %10.3f %10s\n", "total (passed tests)",
+                   total_fresh * 1000, total_first * 1000, "n/a");
+        }
+        delete t;
     }
+    printf("============================================================="
+           "======================\n");
+    return num_failed;
 }
 
 int main(int argc, char** argv)
 {
-    const int n_tests = 31;
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+    const int n_tests = 58;
+#else
+    const int n_tests = 57;
+#endif
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    bool random_scheduling = false;
+    unsigned int random_seed = 0;
+    bool report_counters = false;
+    bool report_usage = false;
+    bool run_all = false;
 
     TestResults (*test[n_tests])(ITaskSystem*) = {
         simpleTestSync,
@@ -83,6 +172,37 @@ int main(int argc, char** argv)
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        recursiveFibonacciNestedTest,
+        recursiveFibonacciNestedAsyncTest,
+        parallelForTest,
+        parallelForRangeTest,
+        parallelReduceTest,
+        parallelInclusiveScanTest,
+        graphReplayTest,
+        graphReplayGenericTest,
+        futureChainTest,
+        pingPongEqualAffinityAsyncTest,
+        superLightAffinityAsyncTest,
+        pingPongEqualFusedAsyncTest,
+        superLightFusedAsyncTest,
+        multiTenantTest,
+        resizeConcurrencyTest,
+        strictGraphDepsMediumRandom,
+        strictGraphDepsMediumBatch,
+        strictGraphDepsLargeBatch,
+        multiProcessTest,
+        adaptiveGrainTest,
+        staticSchedulingTest,
+        streamTriadTest,
+        blockedTransposeTest,
+        spmvTest,
+        randomGatherTest,
+        concurrentSubmittersTest,
+        concurrentSubmittersLatencyTest,
+        concurrentSubmittersAsyncTest,
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+        coroutineChainTest,
+#endif
     };
 
     std::string test_names[n_tests] = {
@@ -115,6 +235,37 @@ int main(int argc, char** argv)
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "recursive_fibonacci_nested",
+        "recursive_fibonacci_nested_async",
+        "parallel_for",
+        "parallel_for_range",
+        "parallel_reduce",
+        "parallel_inclusive_scan",
+        "graph_replay",
+        "graph_replay_generic",
+        "future_chain",
+        "ping_pong_equal_affinity_async",
+        "super_light_affinity_async",
+        "ping_pong_equal_fused_async",
+        "super_light_fused_async",
+        "multi_tenant",
+        "resize_concurrency",
+        "strict_graph_deps_med_random_async",
+        "strict_graph_deps_med_batch_async",
+        "strict_graph_deps_large_batch_async",
+        "multi_process",
+        "adaptive_grain",
+        "static_scheduling",
+        "stream_triad",
+        "blocked_transpose",
+        "spmv",
+        "random_gather",
+        "concurrent_submitters",
+        "concurrent_submitters_latency",
+        "concurrent_submitters_async",
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+        "coroutine_chain",
+#endif
     };
  
     // Parse commandline options
@@ -122,10 +273,16 @@ int main(int argc, char** argv)
     static struct option long_options[] = {
         {"num_threads",           1, 0,  'n'},
         {"num_timing_iterations", 1, 0,  'i'},
+        {"record_schedule",       1, 0,  'r'},
+        {"replay_schedule",       1, 0,  'p'},
+        {"random_seed",           1, 0,  's'},
+        {"counters",              0, 0,  'c'},
+        {"usage",                 0, 0,  'u'},
+        {"all",                   0, 0,  'a'},
         {"help",                  0, 0,  '?'},
     };
 
-    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "n:i:r:p:s:cua?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'n':
@@ -134,6 +291,25 @@ int main(int argc, char** argv)
         case 'i':
             num_timing_iterations = atoi(optarg);
             break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'p':
+            replay_path = optarg;
+            break;
+        case 's':
+            random_scheduling = true;
+            random_seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            report_counters = true;
+            break;
+        case 'u':
+            report_usage = true;
+            break;
+        case 'a':
+            run_all = true;
+            break;
         case '?':
         default:
             usage(argv[0], test_names, n_tests);
@@ -141,6 +317,20 @@ int main(int argc, char** argv)
         }
     }
 
+    if (run_all) {
+        if (record_path != NULL || replay_path != NULL) {
+            fprintf(stderr, "Error: --all cannot record or replay a schedule\n");
+            return 1;
+        }
+        if (report_counters || report_usage) {
+            fprintf(stderr, "Error: --all does not report counters or usage\n");
+            return 1;
+        }
+        int num_failed = runAllTests(test, test_names, n_tests, num_threads,
+                                     num_timing_iterations, random_scheduling, random_seed);
+        return num_failed == 0 ? 0 : 1;
+    }
+
     if (optind + 1 > argc) {
         fprintf(stderr, "Error: missing test_name!\n");
         usage(argv[0], test_names, n_tests);
@@ -149,6 +339,12 @@ int main(int argc, char** argv)
 
     std::string test_name = argv[optind];
 
+    std::vector<ScheduleEvent> replay_schedule;
+    if (replay_path != NULL && !readSchedule(replay_path, &replay_schedule)) {
+        fprintf(stderr, "Error: cannot read schedule from %s\n", replay_path);
+        return 1;
+    }
+
     bool found = false;
     for (int test_id = 0; test_id < n_tests; test_id++) {
         if (test_names[test_id].compare(test_name) != 0) {
@@ -162,15 +358,51 @@ int main(int argc, char** argv)
         printf("============================================================="
                "======================\n");
 
+        if (report_counters && !perfCountersAvailable()) {
+            printf("(perf counters unavailable: %s)\n", PerfCounters::unavailableReason());
+        }
+
         for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
             double minT = 1e30;
+            PerfCounts min_total;
+            ResourceUsage min_usage;
+            std::vector<PerfCounts> min_workers;
             for (int j = 0; j < num_timing_iterations; j++) {
 
+                // Counts the main thread plus, once they exit, every thread
+                // the task system creates
+                PerfCounters total_counters;
+                if (report_counters) {
+                    total_counters.open(0, true);
+                    total_counters.start();
+                }
+
                 // Create a new task system
                 ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
 
+                // Persistent workers already exist and are counted one by
+                // one; pools that create threads per run() show none
+                PerfCounters worker_counters;
+                if (report_counters) {
+                    openProcessThreads(&worker_counters);
+                    worker_counters.start();
+                }
+                if (random_scheduling)
+                    t->setRandomScheduling(true, random_seed);
+                if (!replay_schedule.empty())
+                    t->replaySchedule(replay_schedule);
+                if (record_path != NULL)
+                    t->recordSchedule(true);
+
                 // Run test
                 TestResults result = test[test_id](t);
+                worker_counters.stop();
+
+                // Task systems that do not record return an empty schedule
+                std::vector<ScheduleEvent> recorded = t->recordedSchedule();
+                if (!recorded.empty() && !writeSchedule(record_path, recorded)) {
+                    fprintf(stderr, "Error: cannot write schedule to %s\n", record_path);
+                }
 
                 // Check that the test result was correct
                 if (!result.passed) {
@@ -179,15 +411,38 @@ int main(int argc, char** argv)
                     exit(1);
                 }
 
+                bool fastest = result.time < minT;
                 minT = std::min(minT, result.time);
-
-                // TODO: do this better
-                if( j+1 == num_timing_iterations) {
-                    printf("[%s]:\t\t[%.3f] ms\n", t->name(), minT * 1000);
+                if (fastest)
+                    min_usage = result.usage;
+                if (fastest && report_counters) {
+                    min_workers.clear();
+                    for (int w = 1; w < worker_counters.numThreads(); w++)
+                        min_workers.push_back(worker_counters.readThread(w));
                 }
 
+                const char* name = t->name();
+
                 // Shutdown task system so each timing run is from a clean start
                 delete t;
+                total_counters.stop();
+                if (fastest && report_counters)
+                    min_total = total_counters.read();
+
+                // TODO: do this better
+                if( j+1 == num_timing_iterations) {
+                    printf("[%s]:\t\t[%.3f] ms\n", name, minT * 1000);
+                    if (report_usage)
+                        printResourceUsage(min_usage);
+                    if (min_total.anyValid()) {
+                        printPerfCounts("total", min_total);
+                        for (size_t w = 0; w < min_workers.size(); w++) {
+                            char label[32];
+                            snprintf(label, sizeof(label), "worker %d", (int) w);
+                            printPerfCounts(label, min_workers[w]);
+                        }
+                    }
+                }
             }
         }
         printf("============================================================="
@@ -0,0 +1,35 @@
+#ifndef _TASKSYS_SELECT_H
+#define _TASKSYS_SELECT_H
+
+#include <assert.h>
+#include "tasksys.h"
+
+/*
+ * The task system implementations every harness binary runs its tests or
+ * benchmarks against, in reporting order.
+ */
+enum TaskSystemType {
+    SERIAL,
+    PARALLEL_SPAWN,
+    PARALLEL_THREAD_POOL_SPINNING,
+    PARALLEL_THREAD_POOL_SLEEPING,
+    N_TASKSYS_IMPLS, // This must be in the last position.
+};
+
+inline ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
+    assert(type < N_TASKSYS_IMPLS);
+
+    if (type == SERIAL) {
+        return new TaskSystemSerial(num_threads);
+    } else if (type == PARALLEL_SPAWN) {
+        return new TaskSystemParallelSpawn(num_threads);
+    } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
+        return new TaskSystemParallelThreadPoolSpinning(num_threads);
+    } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
+        return new TaskSystemParallelThreadPoolSleeping(num_threads);
+    } else {
+        return NULL;
+    }
+}
+
+#endif
@@ -9,6 +9,13 @@
 
 #include "CycleTimer.h"
 #include "itasksys.h"
+#include "parallel_for.h"
+#include "parallel_reduce.h"
+#include "taskgraph.h"
+#include "coro_tasksys.h"
+#include "launch_future.h"
+#include "mp_tasksys.h"
+#include "resource_usage.h"
 
 /*
 Sync tests
@@ -18,6 +25,7 @@ TestResults pingPongUnequalTest(ITaskSystem *t);
 TestResults superLightTest(ITaskSystem *t);
 TestResults superSuperLightTest(ITaskSystem *t);
 TestResults recursiveFibonacciTest(ITaskSystem* t);
+TestResults recursiveFibonacciNestedTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeTest(ITaskSystem* t);
@@ -28,15 +36,82 @@ Async with dependencies tests
 =============================
 TestResults pingPongEqualAsyncTest(ITaskSystem *t);
 TestResults pingPongUnequalAsyncTest(ITaskSystem *t);
+TestResults pingPongEqualAffinityAsyncTest(ITaskSystem *t);
+TestResults superLightAffinityAsyncTest(ITaskSystem *t);
+TestResults pingPongEqualFusedAsyncTest(ITaskSystem *t);
+TestResults superLightFusedAsyncTest(ITaskSystem *t);
 TestResults superLightAsyncTest(ITaskSystem *t);
 TestResults superSuperLightAsyncTest(ITaskSystem *t);
 TestResults recursiveFibonacciAsyncTest(ITaskSystem* t);
+TestResults recursiveFibonacciNestedAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
+
+Lambda launch tests
+===================
+TestResults parallelForTest(ITaskSystem *t);
+TestResults parallelForRangeTest(ITaskSystem *t);
+TestResults parallelReduceTest(ITaskSystem *t);
+TestResults parallelInclusiveScanTest(ITaskSystem *t);
+
+Task graph tests
+================
+TestResults graphReplayTest(ITaskSystem *t);
+TestResults graphReplayGenericTest(ITaskSystem *t);
+
+Future tests
+============
+TestResults futureChainTest(ITaskSystem *t);
+
+Multi-tenant tests
+==================
+TestResults multiTenantTest(ITaskSystem *t);
+
+Resizing tests
+==============
+TestResults resizeConcurrencyTest(ITaskSystem *t);
+
+Scheduling debug tests
+======================
+TestResults strictGraphDepsMediumRandom(ITaskSystem *t);
+
+Batched submission tests
+========================
+TestResults strictGraphDepsMediumBatch(ITaskSystem *t);
+TestResults strictGraphDepsLargeBatch(ITaskSystem *t);
+
+Multi-process tests
+===================
+TestResults multiProcessTest(ITaskSystem *t);
+
+Adaptive grain tests
+====================
+TestResults adaptiveGrainTest(ITaskSystem *t);
+
+Static scheduling tests
+=======================
+TestResults staticSchedulingTest(ITaskSystem *t);
+
+Memory-bound tests
+==================
+TestResults streamTriadTest(ITaskSystem *t);
+TestResults blockedTransposeTest(ITaskSystem *t);
+TestResults spmvTest(ITaskSystem *t);
+TestResults randomGatherTest(ITaskSystem *t);
+
+Concurrent submitter tests
+==========================
+TestResults concurrentSubmittersTest(ITaskSystem *t);
+TestResults concurrentSubmittersLatencyTest(ITaskSystem *t);
+TestResults concurrentSubmittersAsyncTest(ITaskSystem *t);
+
+Coroutine tests (C++20 builds only)
+===================================
+TestResults coroutineChainTest(ITaskSystem *t);
 */
 
 /*
@@ -45,6 +120,7 @@ TestResults simpleRunDepsTest(ITaskSystem *t);
 typedef struct {
     bool passed;
     double time;
+    ResourceUsage usage; // CPU time and energy of the timed region
 } TestResults;
 
 /*
@@ -78,6 +154,7 @@ TestResults yourTest(ITaskSystem* t, bool do_async, int num_elements, int num_bu
     // TODO: instantiate your bulk task launches
 
     // Run the test
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         // TODO:
@@ -88,6 +165,7 @@ TestResults yourTest(ITaskSystem* t, bool do_async, int num_elements, int num_bu
         // TODO: make calls to t->run
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Correctness validation
     TestResults results;
@@ -107,6 +185,7 @@ TestResults yourTest(ITaskSystem* t, bool do_async, int num_elements, int num_bu
         }
     }
     results.time = end_time - start_time;
+    results.usage = usage;
 
     delete [] output;
 
@@ -227,6 +306,41 @@ class RecursiveFibonacciTask: public IRunnable {
         }
 };
 
+/*
+ * Each task computes the idx-th fibonacci number by divide and conquer.
+ * Above `cutoff`, fib(n-1) and fib(n-2) are computed by a nested 2-task
+ * bulk launch on the same task system, issued from inside runTask().
+ */
+class NestedFibonacciTask: public IRunnable {
+    public:
+        ITaskSystem *t_;
+        int idx_;
+        int cutoff_;
+        bool split_;
+        int *output_;
+        NestedFibonacciTask(ITaskSystem *t, int idx, int cutoff, bool split, int *output)
+            : t_(t), idx_(idx), cutoff_(cutoff), split_(split), output_(output) {}
+        ~NestedFibonacciTask() {}
+
+        static int serialFn(int n) {
+            if (n < 2) return 1;
+            return serialFn(n-1) + serialFn(n-2);
+        }
+
+        int nestedFn(int n) {
+            if (n <= cutoff_) return serialFn(n);
+            int halves[2];
+            NestedFibonacciTask split(t_, n, cutoff_, true, halves);
+            t_->run(&split, 2);
+            return halves[0] + halves[1];
+        }
+
+        // split launches compute fib(idx-1) and fib(idx-2) in tasks 0 and 1
+        void runTask(int task_id, int num_total_tasks) {
+            output_[task_id] = nestedFn(split_ ? idx_ - 1 - task_id : idx_);
+        }
+};
+
 /*
  * Each task copies its task id into the output.
  */
@@ -310,6 +424,61 @@ class ReduceTask: public IRunnable {
         }
 };
 
+/*
+ * Each task writes the elementwise sum of two input arrays into its chunk
+ * of the output array.
+ */
+class AddArraysTask: public IRunnable {
+    public:
+        int num_elements_;
+        int* a_;
+        int* b_;
+        int* output_;
+        AddArraysTask(int num_elements, int* a, int* b, int* output)
+            : num_elements_(num_elements), a_(a), b_(b), output_(output) {}
+        ~AddArraysTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
+            int start_el = elements_per_task * task_id;
+            int end_el = std::min(start_el + elements_per_task, num_elements_);
+
+            for (int i=start_el; i<end_el; i++)
+                output_[i] = a_[i] + b_[i];
+        }
+};
+
+/*
+ * Each task busy-waits for `task_seconds` and marks itself as run. The
+ * thread finishing the last task records the time.
+ */
+class TimedSpinTask: public IRunnable {
+    public:
+        double task_seconds_;
+        std::vector<int> runs_;
+        std::atomic<int> tasks_done_;
+        double finish_time_;
+        TimedSpinTask(int num_tasks, double task_seconds)
+            : task_seconds_(task_seconds), runs_(num_tasks, 0), tasks_done_(0),
+              finish_time_(0) {}
+        ~TimedSpinTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            double start = CycleTimer::currentSeconds();
+            while (CycleTimer::currentSeconds() - start < task_seconds_);
+            runs_[task_id]++;
+            if (++tasks_done_ == num_total_tasks)
+                finish_time_ = CycleTimer::currentSeconds();
+        }
+
+        bool allRanOnce() const {
+            for (int r : runs_) {
+                if (r != 1) return false;
+            }
+            return true;
+        }
+};
+
 /*
  * Each task computes a number of rows of the output Mandelbrot image.  
  * These rows either form a contiguous chunk of the image (if
@@ -521,6 +690,7 @@ TestResults simpleTest(ITaskSystem* t, bool do_async) {
     SimpleMultiplyTask second = SimpleMultiplyTask(num_elements, array);
 
     // Run the test
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> firstDeps;
@@ -534,6 +704,7 @@ TestResults simpleTest(ITaskSystem* t, bool do_async) {
         t->run(&second, num_tasks);
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Correctness validation
     TestResults results;
@@ -553,6 +724,7 @@ TestResults simpleTest(ITaskSystem* t, bool do_async) {
         }
     }
     results.time = end_time - start_time;
+    results.usage = usage;
 
     delete [] array;
 
@@ -585,7 +757,8 @@ TestResults simpleTestAsync(ITaskSystem* t) {
  * and does O(base_iters) work per element.
  */
 TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
-                         int num_elements, int base_iters) {
+                         int num_elements, int base_iters,
+                         bool use_affinity = false, bool use_fusion = false) {
 
     int num_tasks = 64;
     int num_bulk_task_launches = 400;   
@@ -615,10 +788,23 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
     }
 
     // Run the test
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
-    TaskID prev_task_id;
+    TaskID prev_task_id = 0;
     for (int i=0; i<num_bulk_task_launches; i++) {
-        if (do_async) {
+        if (do_async && (use_affinity || use_fusion)) {
+            std::vector<TaskID> deps;
+            LaunchHints hints;
+            if (i > 0) {
+                deps.push_back(prev_task_id);
+                if (use_affinity)
+                    hints.affinity_with = prev_task_id;
+                if (use_fusion)
+                    hints.elementwise_after = prev_task_id;
+            }
+            prev_task_id = t->runAsyncWithHints(
+                runnables[i], num_tasks, deps, hints);
+        } else if (do_async) {
             std::vector<TaskID> deps;
             if (i > 0) {
                 deps.push_back(prev_task_id);
@@ -632,6 +818,7 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
     if (do_async)
         t->sync();
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Correctness validation
     TestResults results;
@@ -656,6 +843,7 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
         }
     }
     results.time = end_time - start_time;
+    results.usage = usage;
 
     delete [] input;
     delete [] output;
@@ -713,6 +901,41 @@ TestResults pingPongUnequalAsyncTest(ITaskSystem* t) {
     return pingPongTest(t, false, true, num_elements, base_iters);
 }
 
+/*
+ * Same as the async ping-pong tests, but each launch asks for task i to run
+ * where task i of the previous launch ran (LaunchHints::affinity_with),
+ * since it reads exactly the elements that task wrote.
+ */
+TestResults pingPongEqualAffinityAsyncTest(ITaskSystem* t) {
+    int num_elements = 512 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, true);
+}
+
+TestResults superLightAffinityAsyncTest(ITaskSystem* t) {
+    int num_elements = 32 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, true);
+}
+
+/*
+ * Same as the async ping-pong tests, but each launch is declared
+ * element-wise after the previous one (LaunchHints::elementwise_after):
+ * task i only reads what task i of the previous launch wrote, so it may
+ * start as soon as that task is done rather than after the whole launch.
+ */
+TestResults pingPongEqualFusedAsyncTest(ITaskSystem* t) {
+    int num_elements = 512 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, false, true);
+}
+
+TestResults superLightFusedAsyncTest(ITaskSystem* t) {
+    int num_elements = 32 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, true, true, num_elements, base_iters, false, true);
+}
+
 /*
  * Computation: The following tests compute Fibonacci numbers using
  * recursion. Since the tasks are compute intensive, the tests show
@@ -734,6 +957,7 @@ TestResults recursiveFibonacciTestBase(ITaskSystem* t, bool do_async) {
         fib_tasks[i] = new RecursiveFibonacciTask(fib_index, task_output);
     }
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> deps; // Call runAsyncWithDeps without dependencies
@@ -747,6 +971,7 @@ TestResults recursiveFibonacciTestBase(ITaskSystem* t, bool do_async) {
         }
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Validate correctness 
     TestResults result;
@@ -759,6 +984,7 @@ TestResults recursiveFibonacciTestBase(ITaskSystem* t, bool do_async) {
         }
     }
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] task_output;
     for (int i = 0; i < num_bulk_task_launches; i++) {
@@ -776,6 +1002,67 @@ TestResults recursiveFibonacciAsyncTest(ITaskSystem* t) {
     return recursiveFibonacciTestBase(t, true);
 }
 
+/*
+ * Computation: Same result as recursiveFibonacciTest, but every task splits
+ * its Fibonacci computation into nested run() calls made from inside
+ * runTask(). Task systems must let a thread waiting on a nested launch keep
+ * making progress, or these tests deadlock.
+ */
+TestResults recursiveFibonacciNestedTestBase(ITaskSystem* t, bool do_async) {
+
+    int num_tasks = 64;
+    int num_bulk_task_launches = 4;
+    int fib_index = 25;
+    int cutoff = 15;
+
+    int* task_output = new int[num_tasks];
+    for (int i = 0; i < num_tasks; i++) {
+        task_output[i] = 0;
+    }
+
+    NestedFibonacciTask fib_task(t, fib_index, cutoff, false, task_output);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    if (do_async) {
+        std::vector<TaskID> deps;
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            t->runAsyncWithDeps(&fib_task, num_tasks, deps);
+        }
+        t->sync();
+    } else {
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            t->run(&fib_task, num_tasks);
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_tasks; i++) {
+        if (task_output[i] != 121393) {
+            printf("%d: %d expected=%d\n", i, task_output[i], 121393);
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+    result.usage = usage;
+
+    delete [] task_output;
+
+    return result;
+}
+
+TestResults recursiveFibonacciNestedTest(ITaskSystem* t) {
+    return recursiveFibonacciNestedTestBase(t, false);
+}
+
+TestResults recursiveFibonacciNestedAsyncTest(ITaskSystem* t) {
+    return recursiveFibonacciNestedTestBase(t, true);
+}
+
 /*
  * Computation: The following tests perform exps, logs, and multiplications
  * in a tight for loop. Tasks are sufficiently compute-intensive and lightweight:
@@ -800,6 +1087,7 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
             array_size, &task_output[i*array_size]));
     }
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         if (run_with_dependencies) {
@@ -824,6 +1112,7 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
         }
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     TestResults result;
     result.passed = true;
@@ -846,6 +1135,7 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
         }
     }
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] task_output;
 
@@ -896,6 +1186,7 @@ TestResults mathOperationsInTightForLoopFanInTestBase(ITaskSystem* t, bool do_as
     ReduceTask reduce_task(array_size, num_bulk_task_launches, task_output,
                            final_task_output);
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> no_deps;
@@ -913,6 +1204,7 @@ TestResults mathOperationsInTightForLoopFanInTestBase(ITaskSystem* t, bool do_as
         t->run(&reduce_task, 1);
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     TestResults result;
     result.passed = true;
@@ -937,6 +1229,7 @@ TestResults mathOperationsInTightForLoopFanInTestBase(ITaskSystem* t, bool do_as
         }
     }
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] task_output;
     delete [] final_task_output;
@@ -1004,6 +1297,7 @@ TestResults mathOperationsInTightForLoopReductionTreeTestBase(ITaskSystem* t, bo
         num_reduce_tasks /= 2;
     }
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> no_deps;
@@ -1050,6 +1344,7 @@ TestResults mathOperationsInTightForLoopReductionTreeTestBase(ITaskSystem* t, bo
         }
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     TestResults result;
     result.passed = true;
@@ -1077,6 +1372,7 @@ TestResults mathOperationsInTightForLoopReductionTreeTestBase(ITaskSystem* t, bo
         }
     }
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] buffer1;
     delete [] buffer2;
@@ -1124,6 +1420,7 @@ TestResults spinBetweenRunCallsTestBase(ITaskSystem *t, bool do_async) {
     LightTask light_task(light_task_output);
     RecursiveFibonacciTask medium_task(40, med_task_output);
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> deps;
@@ -1146,6 +1443,7 @@ TestResults spinBetweenRunCallsTestBase(ITaskSystem *t, bool do_async) {
         t->run(&light_task, num_light_tasks);
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Validate correctness
     TestResults result;
@@ -1156,6 +1454,7 @@ TestResults spinBetweenRunCallsTestBase(ITaskSystem *t, bool do_async) {
         }
     }
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] light_task_output;
     delete [] med_task_output;
@@ -1197,6 +1496,7 @@ TestResults mandelbrotChunkedTestBase(ITaskSystem* t, bool do_async) {
     MandelbrotTask mandel_task(&ma, true);  // No interleaving
 
     // time task-based implementation
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     if (do_async) {
         std::vector<TaskID> deps; // Call runAsyncWithDeps without dependencies.
@@ -1206,6 +1506,7 @@ TestResults mandelbrotChunkedTestBase(ITaskSystem* t, bool do_async) {
         t->run(&mandel_task, num_tasks);
     }
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     // Validate correctness of the task-based implementation
     // against sequential implementation
@@ -1225,6 +1526,7 @@ TestResults mandelbrotChunkedTestBase(ITaskSystem* t, bool do_async) {
     }
     
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete [] golden;
     delete [] ma.output;
@@ -1256,6 +1558,7 @@ TestResults simpleRunDepsTest(ITaskSystem *t) {
     std::vector<TaskID> c_deps;
 
     
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     auto a_taskid = t->runAsyncWithDeps(a, 10, a_deps);
 
@@ -1267,10 +1570,12 @@ TestResults simpleRunDepsTest(ITaskSystem *t) {
 
     t->sync();
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
 
     TestResults result;
     result.passed = true;
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete a;
     delete b;
@@ -1304,6 +1609,7 @@ TestResults strictDiamondDepsTest(ITaskSystem *t) {
     std::vector<TaskID> c_deps;
     std::vector<TaskID> d_deps;
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
     auto a_taskid = t->runAsyncWithDeps(a, 1, a_deps);
 
@@ -1319,10 +1625,12 @@ TestResults strictDiamondDepsTest(ITaskSystem *t) {
 
     t->sync();
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
     
     TestResults result;
     result.passed = done[3];
     result.time = end_time - start_time;
+    result.usage = usage;
 
     delete[] done;
     delete a;
@@ -1335,9 +1643,12 @@ TestResults strictDiamondDepsTest(ITaskSystem *t) {
 
 /*
  * These tests generates and run a random DAG of n tasks and at most m edges,
- * and make all dependencies are satisfied.
+ * and make all dependencies are satisfied. With `batched`, the whole DAG
+ * is submitted with a single submitBatch() call instead of one
+ * runAsyncWithDeps() call per launch.
  */
-TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed) {
+TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed,
+                                    bool batched = false) {
     // For repeatability.
     srand(seed);
 
@@ -1374,21 +1685,35 @@ TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int se
         tasks.push_back(new StrictDependencyTask(flag_deps[i], done + i));
     }
 
+    ResourceUsage usage_before = ResourceUsage::now();
     double start_time = CycleTimer::currentSeconds();
-    for (int i = 0; i < n; i++) {
-        // Populate TaskID deps.
-        for (int idx : idx_deps[i]) {
-            task_deps[i].push_back(task_ids[idx]);
+    if (batched) {
+        // Intra-batch dependencies are given by index.
+        std::vector<LaunchDesc> launches(n);
+        for (int i = 0; i < n; i++) {
+            launches[i].runnable = tasks[i];
+            launches[i].num_total_tasks = (rand() % 15) + 1;
+            launches[i].batch_deps = idx_deps[i];
+        }
+        t->submitBatch(launches.data(), n, task_ids);
+    } else {
+        for (int i = 0; i < n; i++) {
+            // Populate TaskID deps.
+            for (int idx : idx_deps[i]) {
+                task_deps[i].push_back(task_ids[idx]);
+            }
+            // Launch async and record this task's id.
+            task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
         }
-        // Launch async and record this task's id.
-        task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
     }
     t->sync();
     double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
     
     TestResults result;
     result.passed = done[n-1];
     result.time = end_time - start_time;
+    result.usage = usage;
     return result;
 }
 
@@ -1400,6 +1725,1239 @@ TestResults strictGraphDepsMedium(ITaskSystem* t) {
     return strictGraphDepsTestBase(t,100,1000,0);
 }
 
+/*
+ * Same as strictGraphDepsMedium, but the task system picks among all
+ * available work at random (ITaskSystem::setRandomScheduling()), which
+ * shakes out assumptions about the order launches run in.
+ */
+TestResults strictGraphDepsMediumRandom(ITaskSystem* t) {
+    t->setRandomScheduling(true, 149);
+    return strictGraphDepsTestBase(t,100,1000,0);
+}
+
 TestResults strictGraphDepsLarge(ITaskSystem* t) {
     return strictGraphDepsTestBase(t,1000,20000,0);
 }
+
+TestResults strictGraphDepsMediumBatch(ITaskSystem* t) {
+    return strictGraphDepsTestBase(t,100,1000,0,true);
+}
+
+TestResults strictGraphDepsLargeBatch(ITaskSystem* t) {
+    return strictGraphDepsTestBase(t,1000,20000,0,true);
+}
+
+/*
+ * Computation: Same element-wise ping-pong computation as pingPongTest, but
+ * written as lambdas passed to parallel_for / parallel_for_range instead of
+ * PingPongTask runnables. Each of the 400 launches is split into chunks of
+ * `grain` elements.
+ */
+TestResults parallelForTestBase(ITaskSystem* t, bool use_range) {
+
+    int num_elements = 512 * 1024;
+    int num_bulk_task_launches = 400;
+    int base_iters = 32;
+    int grain = num_elements / 64;
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i=0; i<num_elements; i++) {
+        input[i] = i;
+        output[i] = 0;
+    }
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        int* in = (i % 2 == 0) ? input : output;
+        int* out = (i % 2 == 0) ? output : input;
+        if (use_range) {
+            parallel_for_range(t, 0, num_elements, grain, [=](TaskRange r) {
+                for (int j = r.begin; j < r.end; j++)
+                    out[j] = PingPongTask::ping_pong_work(base_iters, in[j]);
+            });
+        } else {
+            parallel_for(t, num_elements, grain, [=](int j) {
+                out[j] = PingPongTask::ping_pong_work(base_iters, in[j]);
+            });
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+
+    int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input;
+    for (int i=0; i<num_elements; i++) {
+        int value = i;
+        for (int j=0; j<num_bulk_task_launches; j++)
+            value = PingPongTask::ping_pong_work(base_iters, value);
+        if (buffer[i] != value) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, buffer[i], value);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] input;
+    delete [] output;
+
+    return results;
+}
+
+TestResults parallelForTest(ITaskSystem* t) {
+    return parallelForTestBase(t, false);
+}
+
+TestResults parallelForRangeTest(ITaskSystem* t) {
+    return parallelForTestBase(t, true);
+}
+
+/*
+ * Computation: Sums 1/(i+1) over 8M doubles with parallel_reduce, 20 times.
+ * The deterministic reduction must give bit-identical results on every
+ * launch; both modes must match the serial sum up to rounding.
+ */
+TestResults parallelReduceTest(ITaskSystem* t) {
+
+    int num_elements = 8 * 1024 * 1024;
+    int num_reductions = 20;
+    int grain = 64 * 1024;
+
+    double* input = new double[num_elements];
+    double serial_sum = 0.0;
+    for (int i = 0; i < num_elements; i++) {
+        input[i] = 1.0 / (i + 1);
+        serial_sum += input[i];
+    }
+
+    auto sum_range = [input](TaskRange r, double acc) {
+        for (int i = r.begin; i < r.end; i++)
+            acc += input[i];
+        return acc;
+    };
+    auto add = [](double a, double b) { return a + b; };
+
+    std::vector<double> sums(num_reductions);
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_reductions; i++) {
+        sums[i] = parallel_reduce(t, 0, num_elements, grain, 0.0, sum_range, add,
+                                  i % 2 == 0);
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < num_reductions; i++) {
+        if (std::fabs(sums[i] - serial_sum) > 1e-9 * serial_sum ||
+            (i % 2 == 0 && sums[i] != sums[0])) {
+            results.passed = false;
+            printf("%d: %.17g expected=%.17g\n", i, sums[i], serial_sum);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] input;
+
+    return results;
+}
+
+/*
+ * Computation: Inclusive prefix sum of 8M ints with parallel_inclusive_scan
+ * into a separate output array, repeated 20 times and checked against a
+ * serial scan. One more (untimed) scan runs in place on the input and must
+ * give the same result.
+ */
+TestResults parallelInclusiveScanTest(ITaskSystem* t) {
+
+    int num_elements = 8 * 1024 * 1024;
+    int num_scans = 20;
+    int grain = 64 * 1024;
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        input[i] = i % 13;
+    }
+
+    auto add = [](int a, int b) { return a + b; };
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_scans; i++) {
+        parallel_inclusive_scan(t, input, output, num_elements, grain, 0, add);
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    int expected = 0;
+    for (int i = 0; i < num_elements; i++) {
+        expected += input[i];
+        if (output[i] != expected) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, output[i], expected);
+            break;
+        }
+    }
+    parallel_inclusive_scan(t, input, input, num_elements, grain, 0, add);
+    for (int i = 0; i < num_elements && results.passed; i++) {
+        if (input[i] != output[i]) {
+            results.passed = false;
+            printf("in place %d: %d expected=%d\n", i, input[i], output[i]);
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] input;
+    delete [] output;
+
+    return results;
+}
+
+/*
+ * Computation: The ping-pong chain of pingPongTest (400 dependent launches
+ * of 64 light tasks) is captured once with a TaskGraphRecorder and then
+ * launched 20 times, syncing after each launch. Each element is incremented
+ * once per launch of the chain, so any dependency violation within or
+ * across replays shows up in the final counts. The generic variant calls
+ * TaskGraph::replay() directly, the path of every task system that does
+ * not override ITaskSystem::launch().
+ */
+TestResults graphReplayTestBase(ITaskSystem* t, bool generic_replay) {
+
+    int num_elements = 32 * 1024;
+    int num_tasks = 64;
+    int num_bulk_task_launches = 400;
+    int num_replays = 20;
+    int base_iters = 2;    // ping_pong_work(2, x) == x + 1
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i=0; i<num_elements; i++) {
+        input[i] = i;
+        output[i] = 0;
+    }
+
+    std::vector<PingPongTask*> runnables(num_bulk_task_launches);
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        if (i % 2 == 0)
+            runnables[i] = new PingPongTask(num_elements, input, output, true, base_iters);
+        else
+            runnables[i] = new PingPongTask(num_elements, output, input, true, base_iters);
+    }
+
+    TaskGraphRecorder recorder;
+    TaskID prev_task_id = 0;
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        std::vector<TaskID> deps;
+        if (i > 0) {
+            deps.push_back(prev_task_id);
+        }
+        prev_task_id = recorder.runAsyncWithDeps(runnables[i], num_tasks, deps);
+    }
+    TaskGraph graph = recorder.graph();
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i=0; i<num_replays; i++) {
+        if (generic_replay)
+            graph.replay(t);
+        else
+            t->launch(graph);
+        t->sync();
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input;
+    for (int i=0; i<num_elements; i++) {
+        int expected = i + num_bulk_task_launches * num_replays;
+        if (buffer[i] != expected) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, buffer[i], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] input;
+    delete [] output;
+    for (int i=0; i<num_bulk_task_launches; i++)
+        delete runnables[i];
+
+    return results;
+}
+
+TestResults graphReplayTest(ITaskSystem* t) {
+    return graphReplayTestBase(t, false);
+}
+
+TestResults graphReplayGenericTest(ITaskSystem* t) {
+    return graphReplayTestBase(t, true);
+}
+
+/*
+ * Computation: Two independent ping-pong chains of 200 launches (64 tasks
+ * each, over separate buffers) are built with LaunchFuture::then(), joined
+ * with when_all(), and followed by a launch that adds the two final
+ * buffers. The sum is only right if every link of both chains finished
+ * before the join ran.
+ */
+TestResults futureChainTest(ITaskSystem* t) {
+
+    int num_elements = 32 * 1024;
+    int num_tasks = 64;
+    int num_bulk_task_launches = 200;
+    int base_iters = 2;    // ping_pong_work(2, x) == x + 1
+
+    int* buffers[4];
+    for (int b = 0; b < 4; b++) {
+        buffers[b] = new int[num_elements];
+        for (int i = 0; i < num_elements; i++) {
+            buffers[b][i] = (b % 2 == 0) ? i : 0;
+        }
+    }
+    int* sum = new int[num_elements];
+
+    std::vector<PingPongTask*> runnables;
+    for (int chain = 0; chain < 2; chain++) {
+        int* input = buffers[2 * chain];
+        int* output = buffers[2 * chain + 1];
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            if (i % 2 == 0)
+                runnables.push_back(new PingPongTask(num_elements, input, output, true, base_iters));
+            else
+                runnables.push_back(new PingPongTask(num_elements, output, input, true, base_iters));
+        }
+    }
+    int* result_a = (num_bulk_task_launches % 2 == 1) ? buffers[1] : buffers[0];
+    int* result_b = (num_bulk_task_launches % 2 == 1) ? buffers[3] : buffers[2];
+    AddArraysTask add_task(num_elements, result_a, result_b, sum);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<LaunchFuture> chains;
+    for (int chain = 0; chain < 2; chain++) {
+        PingPongTask** links = &runnables[chain * num_bulk_task_launches];
+        LaunchFuture f = launch_async(t, links[0], num_tasks);
+        for (int i = 1; i < num_bulk_task_launches; i++) {
+            f = f.then(links[i], num_tasks);
+        }
+        chains.push_back(f);
+    }
+    when_all(chains).then(&add_task, num_tasks);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < num_elements; i++) {
+        int expected = 2 * (i + num_bulk_task_launches);
+        if (sum[i] != expected) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, sum[i], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    for (int b = 0; b < 4; b++)
+        delete [] buffers[b];
+    delete [] sum;
+    for (PingPongTask* runnable : runnables)
+        delete runnable;
+
+    return results;
+}
+
+/*
+ * Computation: Two tenants share the task system through their own
+ * submission contexts (ITaskSystem::createContext()). The "bulk" tenant
+ * launches 4096 tasks of 20us each; right after, the "interactive" tenant
+ * launches 4 such tasks. The reported time is the interactive launch's
+ * submit-to-completion latency, which stays far below the bulk launch's
+ * duration when contexts are fair-shared.
+ */
+TestResults multiTenantTest(ITaskSystem* t) {
+    int num_bulk_tasks = 4096;
+    int num_interactive_tasks = 4;
+    double task_seconds = 20e-6;
+
+    TimedSpinTask bulk(num_bulk_tasks, task_seconds);
+    TimedSpinTask interactive(num_interactive_tasks, task_seconds);
+    LaunchHints bulk_hints;
+    bulk_hints.context = t->createContext("bulk", 1);
+    LaunchHints interactive_hints;
+    interactive_hints.context = t->createContext("interactive", 1);
+    std::vector<TaskID> no_deps;
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    t->runAsyncWithHints(&bulk, num_bulk_tasks, no_deps, bulk_hints);
+    double submit_time = CycleTimer::currentSeconds();
+    t->runAsyncWithHints(&interactive, num_interactive_tasks, no_deps, interactive_hints);
+    t->sync();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = bulk.allRanOnce() && interactive.allRanOnce();
+    if (!results.passed)
+        printf("a task did not run exactly once\n");
+    results.time = interactive.finish_time_ - submit_time;
+    results.usage = usage;
+    return results;
+}
+
+/*
+ * Computation: An element-wise addition of two 64K-element arrays (64
+ * tasks) is run after resizing the task system to 1, 16 and 2 threads
+ * with setConcurrency(), and once more after the task system has been
+ * idle for longer than its idle-shrink timeout, so idle workers had to
+ * give up their cores and come back for the launch. Only the run() calls
+ * are timed.
+ */
+TestResults resizeConcurrencyTest(ITaskSystem* t) {
+    int num_elements = 64 * 1024;
+    int num_tasks = 64;
+    int thread_counts[] = {1, 16, 2};
+    int num_phases = 4;
+
+    int* a = new int[num_elements];
+    int* b = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        a[i] = i;
+        b[i] = 2 * i;
+    }
+    AddArraysTask add_task(num_elements, a, b, output);
+
+    TestResults results;
+    results.passed = true;
+    results.time = 0;
+    for (int phase = 0; phase < num_phases && results.passed; phase++) {
+        if (phase < 3) {
+            t->setConcurrency(thread_counts[phase]);
+        } else {
+            t->setIdleShrinkTimeout(0.001);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        for (int i = 0; i < num_elements; i++)
+            output[i] = 0;
+
+        ResourceUsage usage_before = ResourceUsage::now();
+        double start_time = CycleTimer::currentSeconds();
+        t->run(&add_task, num_tasks);
+        results.time += CycleTimer::currentSeconds() - start_time;
+        results.usage += ResourceUsage::now() - usage_before;
+
+        for (int i = 0; i < num_elements; i++) {
+            if (output[i] != 3 * i) {
+                results.passed = false;
+                printf("phase %d: %d: %d expected=%d\n", phase, i, output[i], 3 * i);
+                break;
+            }
+        }
+    }
+    t->setIdleShrinkTimeout(0);
+
+    delete [] a;
+    delete [] b;
+    delete [] output;
+    return results;
+}
+
+/*
+ * Task of multiProcessTest that kills its own worker process.
+ */
+class CrashingTask : public IRunnable {
+    public:
+        int crash_task_;
+        int* ran_;
+
+        CrashingTask(int crash_task, int* ran) : crash_task_(crash_task), ran_(ran) {}
+        ~CrashingTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (task_id == crash_task_)
+                raise(SIGKILL);
+            ran_[task_id] = 1;
+        }
+};
+
+/*
+ * Computation: The 400-launch ping-pong chain of pingPongTest (equal work,
+ * 64 tasks per launch) runs on a 4-process TaskSystemMultiProcess, with
+ * its buffers in shared memory, and the result is compared against the
+ * same chain run on the task system under test. Then a 16-task launch
+ * whose task 5 kills its worker process must still complete, with that
+ * one task reported as failed. Only the multi-process chain is timed.
+ */
+TestResults multiProcessTest(ITaskSystem* t) {
+    int num_elements = 64 * 1024;
+    int base_iters = 32;
+    int num_tasks = 64;
+    int num_bulk_task_launches = 400;
+    int num_crash_tasks = 16;
+    int crash_task = 5;
+    size_t buffer_bytes = num_elements * sizeof(int);
+
+    int* input = (int*) TaskSystemMultiProcess::allocShared(buffer_bytes);
+    int* output = (int*) TaskSystemMultiProcess::allocShared(buffer_bytes);
+    int* ran = (int*) TaskSystemMultiProcess::allocShared(num_crash_tasks * sizeof(int));
+    int* ref_input = new int[num_elements];
+    int* ref_output = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        input[i] = ref_input[i] = i;
+        output[i] = ref_output[i] = 0;
+    }
+
+    PingPongTask forward(num_elements, input, output, true, base_iters);
+    PingPongTask backward(num_elements, output, input, true, base_iters);
+    PingPongTask ref_forward(num_elements, ref_input, ref_output, true, base_iters);
+    PingPongTask ref_backward(num_elements, ref_output, ref_input, true, base_iters);
+    CrashingTask crashing(crash_task, ran);
+
+    TestResults results;
+    results.passed = true;
+    {
+        TaskSystemMultiProcess mp(4);
+        mp.registerRunnable(&forward);
+        mp.registerRunnable(&backward);
+        mp.registerRunnable(&crashing);
+
+        ResourceUsage usage_before = ResourceUsage::now();
+        double start_time = CycleTimer::currentSeconds();
+        TaskID prev_task_id = 0;
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            std::vector<TaskID> deps;
+            if (i > 0)
+                deps.push_back(prev_task_id);
+            prev_task_id = mp.runAsyncWithDeps(
+                i % 2 == 0 ? &forward : &backward, num_tasks, deps);
+        }
+        mp.sync();
+        results.time = CycleTimer::currentSeconds() - start_time;
+        results.usage = ResourceUsage::now() - usage_before;
+
+        mp.run(&crashing, num_crash_tasks);
+        for (int i = 0; i < num_crash_tasks; i++) {
+            if (ran[i] != (i != crash_task)) {
+                results.passed = false;
+                printf("crash launch: task %d ran=%d\n", i, ran[i]);
+                break;
+            }
+        }
+        if (mp.numFailedTasks() != 1) {
+            results.passed = false;
+            printf("%d failed tasks expected=1\n", mp.numFailedTasks());
+        }
+    }
+
+    for (int i = 0; i < num_bulk_task_launches; i++)
+        t->run(i % 2 == 0 ? &ref_forward : &ref_backward, num_tasks);
+
+    int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input;
+    int* ref_buffer = (num_bulk_task_launches % 2 == 1) ? ref_output : ref_input;
+    for (int i = 0; i < num_elements && results.passed; i++) {
+        if (buffer[i] != ref_buffer[i]) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, buffer[i], ref_buffer[i]);
+        }
+    }
+
+    TaskSystemMultiProcess::freeShared(input, buffer_bytes);
+    TaskSystemMultiProcess::freeShared(output, buffer_bytes);
+    TaskSystemMultiProcess::freeShared(ran, num_crash_tasks * sizeof(int));
+    delete [] ref_input;
+    delete [] ref_output;
+    return results;
+}
+
+/*
+ * Task of adaptiveGrainTest: counts how many times each task index ran,
+ * after `work` iterations of busy work.
+ */
+class CountingTask : public IRunnable {
+    public:
+        std::vector<int> runs_;
+        int work_;
+        volatile int sink_;
+
+        CountingTask(int num_tasks, int work) : runs_(num_tasks, 0), work_(work), sink_(0) {}
+        ~CountingTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            int accum = task_id;
+            for (int i = 0; i < work_; i++)
+                accum = accum * 31 + i;
+            sink_ = accum;
+            runs_[task_id]++;
+        }
+
+        bool allRan(int times) const {
+            for (int r : runs_) {
+                if (r != times) return false;
+            }
+            return true;
+        }
+};
+
+/*
+ * Computation: 500 launches each of three runnables: 4096 near-empty tasks,
+ * 256 tasks of moderate work, and 4 tiny tasks (run() launches small
+ * enough to run inline once their cost is known). Launches alternate
+ * between run() and runAsyncWithDeps(), so task systems that learn task
+ * costs switch chunk sizes and inline decisions while the test runs.
+ * Every task index must run exactly once per launch.
+ */
+TestResults adaptiveGrainTest(ITaskSystem* t) {
+    int num_launches = 500;
+    CountingTask empty(4096, 0);
+    CountingTask moderate(256, 2000);
+    CountingTask tiny(4, 10);
+    std::vector<TaskID> no_deps;
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_launches; i++) {
+        if (i % 2 == 0) {
+            t->run(&empty, empty.runs_.size());
+            t->run(&moderate, moderate.runs_.size());
+            t->run(&tiny, tiny.runs_.size());
+        } else {
+            t->runAsyncWithDeps(&empty, empty.runs_.size(), no_deps);
+            t->runAsyncWithDeps(&moderate, moderate.runs_.size(), no_deps);
+            t->runAsyncWithDeps(&tiny, tiny.runs_.size(), no_deps);
+            t->sync();
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = empty.allRan(num_launches) && moderate.allRan(num_launches) &&
+                     tiny.allRan(num_launches);
+    if (!results.passed)
+        printf("a task did not run once per launch\n");
+    results.time = end_time - start_time;
+    results.usage = usage;
+    return results;
+}
+
+/*
+ * One sweep of a 1D three-point smoothing stencil: each task averages a
+ * contiguous block of `input` into `output`, with fixed boundary values.
+ */
+class SmoothTask : public IRunnable {
+    public:
+        int num_elements_;
+        const int* input_;
+        int* output_;
+        std::thread::id caller_;            // thread that calls run()
+        std::atomic<int> caller_tasks_;     // tasks it ran itself
+
+        SmoothTask(int num_elements, const int* input, int* output)
+            : num_elements_(num_elements), input_(input), output_(output),
+              caller_(std::this_thread::get_id()), caller_tasks_(0) {}
+        ~SmoothTask() {}
+
+        static inline int smooth(const int* in, int i, int n) {
+            if (i == 0 || i == n - 1)
+                return in[i];
+            return (in[i - 1] + in[i] + in[i + 1]) / 3;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            int begin = (long long) task_id * num_elements_ / num_total_tasks;
+            int end = (long long) (task_id + 1) * num_elements_ / num_total_tasks;
+            for (int i = begin; i < end; i++)
+                output_[i] = smooth(input_, i, num_elements_);
+            if (std::this_thread::get_id() == caller_)
+                caller_tasks_++;
+        }
+};
+
+/*
+ * Computation: An iterative solver pattern: 300 sweeps of a smoothing
+ * stencil over a 256K-element array, ping-ponging between two buffers,
+ * one 64-task run() per sweep, with the task system in static scheduling
+ * mode (ITaskSystem::setStaticScheduling()) so each worker keeps sweeping
+ * the same block of the array. The result is checked against a serial
+ * computation, and the thread calling run() must have swept blocks too
+ * rather than leaving its core idle.
+ */
+TestResults staticSchedulingTest(ITaskSystem* t) {
+    int num_elements = 256 * 1024;
+    int num_tasks = 64;
+    int num_sweeps = 300;
+
+    std::vector<int> a(num_elements), b(num_elements);
+    for (int i = 0; i < num_elements; i++)
+        a[i] = (i * 7919) % 100000;
+    std::vector<int> ref_a(a), ref_b(num_elements);
+
+    SmoothTask forward(num_elements, a.data(), b.data());
+    SmoothTask backward(num_elements, b.data(), a.data());
+
+    t->setStaticScheduling(true);
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_sweeps; i++)
+        t->run(i % 2 == 0 ? &forward : &backward, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+    t->setStaticScheduling(false);
+
+    for (int i = 0; i < num_sweeps; i++) {
+        std::vector<int>& in = (i % 2 == 0) ? ref_a : ref_b;
+        std::vector<int>& out = (i % 2 == 0) ? ref_b : ref_a;
+        for (int j = 0; j < num_elements; j++)
+            out[j] = SmoothTask::smooth(in.data(), j, num_elements);
+    }
+
+    TestResults results;
+    results.passed = true;
+    std::vector<int>& result = (num_sweeps % 2 == 1) ? b : a;
+    std::vector<int>& expected = (num_sweeps % 2 == 1) ? ref_b : ref_a;
+    for (int i = 0; i < num_elements; i++) {
+        if (result[i] != expected[i]) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, result[i], expected[i]);
+            break;
+        }
+    }
+    if (forward.caller_tasks_ + backward.caller_tasks_ == 0) {
+        results.passed = false;
+        printf("the thread calling run() ran no tasks\n");
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+    return results;
+}
+
+/*
+ * Index range [begin, end) of the task_id-th of num_total_tasks equal
+ * blocks of `n` elements.
+ */
+static inline void taskBlock(long long n, int task_id, int num_total_tasks,
+                             long long* begin, long long* end) {
+    *begin = n * task_id / num_total_tasks;
+    *end = n * (task_id + 1) / num_total_tasks;
+}
+
+/*
+ * STREAM kernels over three arrays: with init_ set, each task writes the
+ * initial values of its block (so the pages are first touched by the
+ * thread that later streams them); otherwise it computes the triad
+ * a[i] = b[i] + scalar * c[i] over its block.
+ */
+class StreamTriadTask : public IRunnable {
+    public:
+        long long num_elements_;
+        float* a_;
+        float* b_;
+        float* c_;
+        float scalar_;
+        bool init_;
+
+        StreamTriadTask(long long num_elements, float* a, float* b, float* c,
+                        float scalar, bool init)
+            : num_elements_(num_elements), a_(a), b_(b), c_(c), scalar_(scalar),
+              init_(init) {}
+        ~StreamTriadTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            long long begin, end;
+            taskBlock(num_elements_, task_id, num_total_tasks, &begin, &end);
+            if (init_) {
+                for (long long i = begin; i < end; i++) {
+                    a_[i] = 0.f;
+                    b_[i] = (float) (i % 1024);
+                    c_[i] = (float) (i % 7);
+                }
+            } else {
+                for (long long i = begin; i < end; i++)
+                    a_[i] = b_[i] + scalar_ * c_[i];
+            }
+        }
+};
+
+/*
+ * Computation: The STREAM triad a = b + 3 * c over three float arrays
+ * taking 1 GB together, 10 times, with 256 tasks per launch. The arrays
+ * are first touched by a launch with the same partitioning, so on NUMA
+ * machines each block lives near the thread that initialized it; only
+ * schedulers that send the same block to the same thread again stream
+ * from local memory. Only the triad launches are timed.
+ */
+TestResults streamTriadTest(ITaskSystem* t) {
+    long long num_elements = (1LL << 30) / (3 * sizeof(float));
+    int num_tasks = 256;
+    int num_iterations = 10;
+    float scalar = 3.f;
+
+    float* a = new float[num_elements];
+    float* b = new float[num_elements];
+    float* c = new float[num_elements];
+    StreamTriadTask init(num_elements, a, b, c, scalar, true);
+    StreamTriadTask triad(num_elements, a, b, c, scalar, false);
+    t->run(&init, num_tasks);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_iterations; i++)
+        t->run(&triad, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (long long i = 0; i < num_elements; i++) {
+        float expected = (float) (i % 1024) + scalar * (float) (i % 7);
+        if (a[i] != expected) {
+            results.passed = false;
+            printf("%lld: %f expected=%f\n", i, a[i], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] a;
+    delete [] b;
+    delete [] c;
+    return results;
+}
+
+/*
+ * Out-of-place transpose of a dim_ x dim_ matrix in tile_ x tile_ tiles.
+ * Each task transposes a horizontal strip of tile rows.
+ */
+class BlockedTransposeTask : public IRunnable {
+    public:
+        int dim_;
+        int tile_;
+        const float* input_;
+        float* output_;
+
+        BlockedTransposeTask(int dim, int tile, const float* input, float* output)
+            : dim_(dim), tile_(tile), input_(input), output_(output) {}
+        ~BlockedTransposeTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            long long begin, end;
+            taskBlock(dim_ / tile_, task_id, num_total_tasks, &begin, &end);
+            for (long long tile_row = begin; tile_row < end; tile_row++) {
+                int row0 = tile_row * tile_;
+                for (int col0 = 0; col0 < dim_; col0 += tile_) {
+                    for (int r = row0; r < row0 + tile_; r++) {
+                        for (int c = col0; c < col0 + tile_; c++)
+                            output_[(long long) c * dim_ + r] = input_[(long long) r * dim_ + c];
+                    }
+                }
+            }
+        }
+};
+
+/*
+ * Computation: Transposes an 8192 x 8192 float matrix (256 MB) into a
+ * second one, 3 times, in 64 x 64 tiles, with 128 tasks of one tile row
+ * each. Reads stream through the input while writes stride through the
+ * output, so the test stresses cache and TLB reach more than bandwidth.
+ */
+TestResults blockedTransposeTest(ITaskSystem* t) {
+    int dim = 8192;
+    int tile = 64;
+    int num_tasks = dim / tile;
+    int num_iterations = 3;
+    long long num_elements = (long long) dim * dim;
+
+    float* input = new float[num_elements];
+    float* output = new float[num_elements];
+    for (long long i = 0; i < num_elements; i++)
+        input[i] = (float) (i % 65521);
+    BlockedTransposeTask transpose(dim, tile, input, output);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_iterations; i++)
+        t->run(&transpose, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (long long r = 0; r < dim && results.passed; r++) {
+        for (long long c = 0; c < dim; c++) {
+            if (output[c * dim + r] != input[r * dim + c]) {
+                results.passed = false;
+                printf("(%lld, %lld): %f expected=%f\n", r, c,
+                       output[c * dim + r], input[r * dim + c]);
+                break;
+            }
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] input;
+    delete [] output;
+    return results;
+}
+
+/*
+ * y = A x for a sparse matrix A in CSR format; each task computes a block
+ * of rows.
+ */
+class SpmvTask : public IRunnable {
+    public:
+        int num_rows_;
+        const int* row_start_;
+        const int* cols_;
+        const float* values_;
+        const float* x_;
+        float* y_;
+
+        SpmvTask(int num_rows, const int* row_start, const int* cols,
+                 const float* values, const float* x, float* y)
+            : num_rows_(num_rows), row_start_(row_start), cols_(cols),
+              values_(values), x_(x), y_(y) {}
+        ~SpmvTask() {}
+
+        static inline float row(const int* row_start, const int* cols,
+                                const float* values, const float* x, int r) {
+            float sum = 0.f;
+            for (int k = row_start[r]; k < row_start[r + 1]; k++)
+                sum += values[k] * x[cols[k]];
+            return sum;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            long long begin, end;
+            taskBlock(num_rows_, task_id, num_total_tasks, &begin, &end);
+            for (long long r = begin; r < end; r++)
+                y_[r] = row(row_start_, cols_, values_, x_, r);
+        }
+};
+
+/*
+ * Computation: 5 sparse matrix-vector products with a 2M x 2M matrix of
+ * 16 nonzeros per row (about 280 MB with the vectors), 256 tasks per
+ * launch.
+ * Half of each row's nonzeros are near the diagonal and half are at
+ * random columns, so accesses to x mix streaming with cache misses, and
+ * rows take different amounts of time.
+ */
+TestResults spmvTest(ITaskSystem* t) {
+    int num_rows = 2 * 1024 * 1024;
+    int nnz_per_row = 16;
+    int band = 64;
+    int num_tasks = 256;
+    int num_iterations = 5;
+    long long nnz = (long long) num_rows * nnz_per_row;
+
+    int* row_start = new int[num_rows + 1];
+    int* cols = new int[nnz];
+    float* values = new float[nnz];
+    float* x = new float[num_rows];
+    float* y = new float[num_rows];
+    unsigned int seed = 12345;
+    for (int r = 0; r <= num_rows; r++)
+        row_start[r] = r * nnz_per_row;
+    for (int r = 0; r < num_rows; r++) {
+        for (int k = 0; k < nnz_per_row; k++) {
+            seed = seed * 1103515245u + 12345u;
+            int col = (k % 2 == 0) ? r + (int) (seed >> 16) % band - band / 2
+                                   : (int) (seed % (unsigned int) num_rows);
+            cols[row_start[r] + k] = std::min(std::max(col, 0), num_rows - 1);
+            values[row_start[r] + k] = (float) ((seed >> 8) % 16) / 16.f;
+        }
+        x[r] = (float) (r % 100) / 100.f;
+    }
+    SpmvTask spmv(num_rows, row_start, cols, values, x, y);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_iterations; i++)
+        t->run(&spmv, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (int r = 0; r < num_rows; r++) {
+        float expected = SpmvTask::row(row_start, cols, values, x, r);
+        if (y[r] != expected) {
+            results.passed = false;
+            printf("%d: %f expected=%f\n", r, y[r], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] row_start;
+    delete [] cols;
+    delete [] values;
+    delete [] x;
+    delete [] y;
+    return results;
+}
+
+/*
+ * output[i] = table[indices[i]] over each task's block of indices.
+ */
+class RandomGatherTask : public IRunnable {
+    public:
+        long long num_indices_;
+        const int* indices_;
+        const int* table_;
+        int* output_;
+
+        RandomGatherTask(long long num_indices, const int* indices,
+                         const int* table, int* output)
+            : num_indices_(num_indices), indices_(indices), table_(table),
+              output_(output) {}
+        ~RandomGatherTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            long long begin, end;
+            taskBlock(num_indices_, task_id, num_total_tasks, &begin, &end);
+            for (long long i = begin; i < end; i++)
+                output_[i] = table_[indices_[i]];
+        }
+};
+
+/*
+ * Computation: Gathers 16M random entries of a 256 MB int table, 5 times,
+ * with 256 tasks per launch. Nearly every load misses in cache and TLB,
+ * so the test is bound by memory latency and by how many misses the
+ * threads keep in flight rather than by bandwidth.
+ */
+TestResults randomGatherTest(ITaskSystem* t) {
+    long long table_size = 64LL * 1024 * 1024;
+    long long num_indices = 16LL * 1024 * 1024;
+    int num_tasks = 256;
+    int num_iterations = 5;
+
+    int* table = new int[table_size];
+    int* indices = new int[num_indices];
+    int* output = new int[num_indices];
+    for (long long i = 0; i < table_size; i++)
+        table[i] = (int) (i * 2654435761u);
+    unsigned long long seed = 88172645463325252ULL;
+    for (long long i = 0; i < num_indices; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        indices[i] = (int) (seed % table_size);
+    }
+    RandomGatherTask gather(num_indices, indices, table, output);
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_iterations; i++)
+        t->run(&gather, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (long long i = 0; i < num_indices; i++) {
+        if (output[i] != table[indices[i]]) {
+            results.passed = false;
+            printf("%lld: %d expected=%d\n", i, output[i], table[indices[i]]);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    delete [] table;
+    delete [] indices;
+    delete [] output;
+    return results;
+}
+
+/*
+ * Computation: 4 submitter threads share the task system, each issuing
+ * 100 rounds of a light launch (8 tasks of almost no work) followed by a
+ * heavy one (64 tasks of 20000 iterations each), on runnables of its
+ * own. With do_async, each submitter chains its launches with
+ * runAsyncWithDeps() and calls sync() at the end; otherwise it calls
+ * run(). Every task must run once per round. If `report_latency`, the
+ * reported time is the mean time per round of the slowest submitter
+ * (per-submitter latency); otherwise it is the wall time of the whole
+ * mix (aggregate throughput).
+ */
+TestResults concurrentSubmittersTestBase(ITaskSystem* t, bool do_async, bool report_latency) {
+    const int num_submitters = 4;
+    int num_rounds = 100;
+
+    std::vector<CountingTask*> light(num_submitters);
+    std::vector<CountingTask*> heavy(num_submitters);
+    std::vector<double> round_time(num_submitters);
+    for (int s = 0; s < num_submitters; s++) {
+        light[s] = new CountingTask(8, 0);
+        heavy[s] = new CountingTask(64, 20000);
+    }
+
+    auto submitter = [&](int s) {
+        double start = CycleTimer::currentSeconds();
+        TaskID prev_id = 0;
+        for (int r = 0; r < num_rounds; r++) {
+            if (do_async) {
+                std::vector<TaskID> deps;
+                if (r > 0)
+                    deps.push_back(prev_id);
+                TaskID light_id = t->runAsyncWithDeps(light[s], 8, deps);
+                prev_id = t->runAsyncWithDeps(heavy[s], 64, std::vector<TaskID>(1, light_id));
+            } else {
+                t->run(light[s], 8);
+                t->run(heavy[s], 64);
+            }
+        }
+        if (do_async)
+            t->sync();
+        round_time[s] = (CycleTimer::currentSeconds() - start) / num_rounds;
+    };
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<std::thread> submitters;
+    for (int s = 0; s < num_submitters; s++)
+        submitters.push_back(std::thread(submitter, s));
+    for (std::thread& thread : submitters)
+        thread.join();
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (int s = 0; s < num_submitters; s++) {
+        if (!light[s]->allRan(num_rounds) || !heavy[s]->allRan(num_rounds)) {
+            results.passed = false;
+            printf("submitter %d: a task did not run once per round\n", s);
+            break;
+        }
+    }
+    if (report_latency)
+        results.time = *std::max_element(round_time.begin(), round_time.end());
+    else
+        results.time = end_time - start_time;
+    results.usage = usage;
+
+    for (int s = 0; s < num_submitters; s++) {
+        delete light[s];
+        delete heavy[s];
+    }
+    return results;
+}
+
+TestResults concurrentSubmittersTest(ITaskSystem* t) {
+    return concurrentSubmittersTestBase(t, false, false);
+}
+
+TestResults concurrentSubmittersLatencyTest(ITaskSystem* t) {
+    return concurrentSubmittersTestBase(t, false, true);
+}
+
+TestResults concurrentSubmittersAsyncTest(ITaskSystem* t) {
+    return concurrentSubmittersTestBase(t, true, false);
+}
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+/*
+ * One request of coroutineChainTest: its ping-pong launches run one after
+ * another, each co_await resuming the chain once the previous launch is done.
+ */
+LaunchChain pingPongChain(ITaskSystem* t, const std::vector<PingPongTask*>& runnables,
+                          int num_tasks) {
+    for (PingPongTask* runnable : runnables) {
+        co_await run_async(t, runnable, num_tasks);
+    }
+}
+
+/*
+ * Computation: 16 independent requests, each a chain of 50 dependent
+ * ping-pong launches of 16 tasks over its own pair of buffers, are driven
+ * concurrently by coroutines from a single submitting thread, then sync()ed.
+ */
+TestResults coroutineChainTest(ITaskSystem* t) {
+
+    int num_requests = 16;
+    int num_elements = 8 * 1024;
+    int num_tasks = 16;
+    int num_bulk_task_launches = 50;
+    int base_iters = 2;    // ping_pong_work(2, x) == x + 1
+
+    std::vector<int*> inputs(num_requests);
+    std::vector<int*> outputs(num_requests);
+    std::vector<std::vector<PingPongTask*> > runnables(num_requests);
+    for (int r = 0; r < num_requests; r++) {
+        inputs[r] = new int[num_elements];
+        outputs[r] = new int[num_elements];
+        for (int i = 0; i < num_elements; i++) {
+            inputs[r][i] = i;
+            outputs[r][i] = 0;
+        }
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            if (i % 2 == 0)
+                runnables[r].push_back(new PingPongTask(
+                    num_elements, inputs[r], outputs[r], true, base_iters));
+            else
+                runnables[r].push_back(new PingPongTask(
+                    num_elements, outputs[r], inputs[r], true, base_iters));
+        }
+    }
+
+    ResourceUsage usage_before = ResourceUsage::now();
+    double start_time = CycleTimer::currentSeconds();
+    for (int r = 0; r < num_requests; r++) {
+        pingPongChain(t, runnables[r], num_tasks);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+    ResourceUsage usage = ResourceUsage::now() - usage_before;
+
+    TestResults results;
+    results.passed = true;
+    for (int r = 0; r < num_requests && results.passed; r++) {
+        int* buffer = (num_bulk_task_launches % 2 == 1) ? outputs[r] : inputs[r];
+        for (int i = 0; i < num_elements; i++) {
+            int expected = i + num_bulk_task_launches;
+            if (buffer[i] != expected) {
+                results.passed = false;
+                printf("request %d, %d: %d expected=%d\n", r, i, buffer[i], expected);
+                break;
+            }
+        }
+    }
+    results.time = end_time - start_time;
+    results.usage = usage;
+
+    for (int r = 0; r < num_requests; r++) {
+        delete [] inputs[r];
+        delete [] outputs[r];
+        for (PingPongTask* runnable : runnables[r])
+            delete runnable;
+    }
+
+    return results;
+}
+#endif